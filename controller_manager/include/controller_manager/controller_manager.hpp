@@ -43,19 +43,30 @@
 #include <as2_core/yaml_utils/yaml_utils.hpp>
 #include <filesystem>
 #include <chrono>
+#include <map>
 #include <pluginlib/class_loader.hpp>
 #include <rclcpp/logging.hpp>
 
+#include "controller_manager/modes_cache.hpp"
 #include "controller_plugin_base/controller_base.hpp"
 #include "as2_msgs/msg/controller_info.hpp"
+#include "std_srvs/srv/trigger.hpp"
 
 class ControllerManager : public as2::Node
 {
 public:
-  ControllerManager() : as2::Node("controller_manager")
+  using ControllerLoader = pluginlib::ClassLoader<controller_plugin_base::ControllerBase>;
+
+  explicit ControllerManager(const rclcpp::NodeOptions& options = rclcpp::NodeOptions())
+      : ControllerManager(options, nullptr) {};
+
+  // several managers hosted in one process can share a single plugin loader
+  ControllerManager(const rclcpp::NodeOptions& options, std::shared_ptr<ControllerLoader> loader)
+      : as2::Node("controller_manager", options), loader_(loader)
   {
-    this->declare_parameter<double>("publish_cmd_freq", 100.0);
-    this->declare_parameter<double>("publish_info_freq", 10.0);
+    this->declare_parameter<double>("publish_cmd_freq", 100.0);  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<std::string>("control_loop_trigger", "timer");  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<double>("publish_info_freq", 1.0);
     try
     {
       this->declare_parameter<std::string>("plugin_name");
@@ -66,18 +77,54 @@ public:
       this->~ControllerManager();
     }
     this->declare_parameter<bool>("use_bypass", true); // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<double>("bypass_keep_alive_freq", 0.0);  // DECLARED, READ ON PLUGIN_BASE
     this->declare_parameter<std::filesystem::path>("plugin_config_file", "");  // ONLY DECLARED, USED IN LAUNCH
     this->declare_parameter<std::filesystem::path>("plugin_available_modes_config_file", "");
+    this->declare_parameter<double>("mode_negotiation_timeout", 2.0);  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<std::string>("state_sync_policy", "approximate");  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<int>("state_sync_queue_size", 5);
+    this->declare_parameter<std::string>("state_source", "pose_twist");
+    this->declare_parameter<std::string>("odometry_topic", "self_localization/odom");
+    this->declare_parameter<double>("control_phase", 0.0);  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<std::string>("transport", "ros");  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<std::string>("trajectory_batch_topic", "motion_reference/trajectory_batch");
+    this->declare_parameter<int>("message_pool_size", 16);  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<std::string>("qos.state.reliability", "default");  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<int>("qos.state.depth", 0);
+    this->declare_parameter<double>("qos.state.deadline", 0.0);
+    this->declare_parameter<std::string>("qos.reference.reliability", "default");
+    this->declare_parameter<int>("qos.reference.depth", 0);
+    this->declare_parameter<double>("qos.reference.deadline", 0.0);
+    this->declare_parameter<std::string>("qos.command.reliability", "default");
+    this->declare_parameter<int>("qos.command.depth", 0);
+    this->declare_parameter<double>("qos.command.lifespan", 0.0);
+    this->declare_parameter<bool>("rate_governor.enabled", false);  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<double>("rate_governor.high_load", 0.8);
+    this->declare_parameter<double>("rate_governor.low_load", 0.3);
+    this->declare_parameter<double>("rate_governor.step", 0.8);
+    this->declare_parameter<double>("watchdog.state_timeout", 0.5);  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<double>("watchdog.reference_timeout", 0.0);
+    this->declare_parameter<std::string>("watchdog.action", "hold");
+    this->declare_parameter<bool>("flight_recorder.enabled", false);  // DECLARED, READ ON PLUGIN_BASE
+    this->declare_parameter<int>("flight_recorder.capacity", 8192);
+    this->declare_parameter<std::string>("flight_recorder.file", "");
+    this->declare_parameter<std::string>("swap_plugin_name", "");
+    this->declare_parameter<bool>("realtime.enabled", false);  // READ ON MAIN
+    this->declare_parameter<int>("realtime.control_priority", 80);
+    this->declare_parameter<int>("realtime.control_cpu", -1);
+    this->declare_parameter<int>("realtime.input_priority", 0);
+    this->declare_parameter<int>("realtime.input_cpu", -1);
 
-    this->get_parameter("publish_cmd_freq", cmd_freq_);
     this->get_parameter("publish_info_freq", info_freq_);
     this->get_parameter("plugin_name", plugin_name_);
     plugin_name_ += "::Plugin";
     // this->get_parameter("plugin_config_file", parameter_string_);      
     this->get_parameter("plugin_available_modes_config_file", available_modes_config_file_);
     
-    loader_ = std::make_shared<pluginlib::ClassLoader<controller_plugin_base::ControllerBase>>(
-        "controller_plugin_base", "controller_plugin_base::ControllerBase");
+    if (!loader_) {
+      loader_ = std::make_shared<ControllerLoader>("controller_plugin_base",
+                                                   "controller_plugin_base::ControllerBase");
+    }
     try
     {
       controller_ = loader_->createSharedInstance(plugin_name_);
@@ -100,16 +147,51 @@ public:
         as2_names::topics::controller::info,
         as2_names::topics::controller::qos_info);
 
-    mode_timer_ = this->create_wall_timer(std::chrono::duration<double>(info_freq_), std::bind(&ControllerManager::mode_timer_callback, this));
+    // served with the control mode services, so a swap never runs during a negotiation
+    swap_plugin_srv_ = this->create_service<std_srvs::srv::Trigger>(
+        "controller/swap_plugin",
+        std::bind(&ControllerManager::swap_plugin_callback, this, std::placeholders::_1,
+                  std::placeholders::_2),
+        rmw_qos_profile_services_default, controller_->getServiceCallbackGroup());
+    active_plugin_name_ = plugin_name_;
+
+    // published on every mode change, the timer is only a heartbeat
+    controller_->setModeChangeCallback(std::bind(&ControllerManager::mode_timer_callback, this));
+    if (info_freq_ > 0.0) {
+      mode_timer_ = this->create_wall_timer(std::chrono::duration<double>(1.0 / info_freq_),
+                                            std::bind(&ControllerManager::mode_timer_callback, this));
+    }
   };
 
   ~ControllerManager() {};
+
+  std::shared_ptr<controller_plugin_base::ControllerBase> getController() const { return controller_; };
+
 private:
   // TODO: move to plugin base?
   void config_available_control_modes(const std::filesystem::path project_path)
   {
-    auto available_input_modes = as2::parse_uint_from_string(
-        as2::find_tag_from_project_exports_path<std::string>(project_path, "input_control_modes"));
+    // the parsed modes are cached, keyed by the package manifest they come from. The platform
+    // modes are matched against them by the plugin base whenever the platform changes
+    std::string manifest;
+    modes_cache::readFile(project_path / "package.xml", manifest);
+    const uint64_t cache_key = modes_cache::hash(project_path.string() + '\0' + manifest);
+
+    std::vector<uint8_t> available_input_modes, available_output_modes;
+    if (manifest.empty() ||
+        !modes_cache::load(cache_key, available_input_modes, available_output_modes)) {
+      available_input_modes = as2::parse_uint_from_string(
+          as2::find_tag_from_project_exports_path<std::string>(project_path, "input_control_modes"));
+      available_output_modes = as2::parse_uint_from_string(
+          as2::find_tag_from_project_exports_path<std::string>(project_path, "output_control_modes"));
+      if (!manifest.empty()) {
+        modes_cache::store(cache_key, available_input_modes, available_output_modes);
+      }
+    } else {
+      RCLCPP_DEBUG(this->get_logger(), "Control modes loaded from cache %s",
+                   modes_cache::entryPath(cache_key).c_str());
+    }
+
     RCLCPP_INFO(this->get_logger(), "==========================================================");
     RCLCPP_INFO(this->get_logger(), "AVAILABLE INPUT MODES: ");
     for (auto mode : available_input_modes)
@@ -117,8 +199,6 @@ private:
       RCLCPP_INFO(this->get_logger(), "\t - %s", as2::controlModeToString(mode).c_str());
        
     }
-    auto available_output_modes = as2::parse_uint_from_string(
-        as2::find_tag_from_project_exports_path<std::string>(project_path, "output_control_modes"));
     RCLCPP_INFO(this->get_logger(), "AVAILABLE OUTPUT MODES: ");
     for (auto mode : available_output_modes)
     {
@@ -131,26 +211,83 @@ private:
     controller_->setOutputControlModesAvailables(available_output_modes);
   };
 
+  // Loads the plugin named in the swap_plugin_name parameter next to the running one and swaps
+  // it in at a tick boundary. The new plugin reads its parameters from the node
+  void swap_plugin_callback(const std_srvs::srv::Trigger::Request::SharedPtr,
+                            std_srvs::srv::Trigger::Response::SharedPtr response)
+  {
+    std::string swap_plugin_name;
+    this->get_parameter("swap_plugin_name", swap_plugin_name);
+    if (swap_plugin_name.empty()) {
+      response->success = false;
+      response->message = "Set the swap_plugin_name parameter to the plugin to swap in";
+      return;
+    }
+    const std::string plugin_name = swap_plugin_name + "::Plugin";
+    if (plugin_name == active_plugin_name_) {
+      response->success = true;
+      return;
+    }
+
+    // the plugin loaded at startup owns the inputs and outputs and is never unloaded
+    std::shared_ptr<controller_plugin_base::ControllerBase> plugin;
+    std::filesystem::path modes_file = available_modes_config_file_;
+    if (plugin_name != plugin_name_.string()) {
+      try {
+        modes_file = loader_->getPluginManifestPath(plugin_name);
+        // plugins are kept once loaded, their parameters can only be declared once
+        auto& standby = standby_plugins_[plugin_name];
+        if (!standby) {
+          auto new_plugin = loader_->createSharedInstance(plugin_name);
+          // parameters and plugin setup, off the control thread
+          new_plugin->initializeStandby(this);
+          standby = new_plugin;
+        }
+        plugin = standby;
+      } catch (const std::exception& e) {
+        response->success = false;
+        response->message = "Failed to load " + plugin_name + ": " + e.what();
+        RCLCPP_ERROR(this->get_logger(), "%s", response->message.c_str());
+        return;
+      }
+    }
+
+    std::string reason;
+    if (!controller_->swapPlugin(plugin, reason)) {
+      response->success = false;
+      response->message = "Swap to " + plugin_name + " rejected: " + reason;
+      return;
+    }
+    RCLCPP_INFO(this->get_logger(), "PLUGIN SWAPPED [%s] -> [%s]", active_plugin_name_.c_str(),
+                plugin_name.c_str());
+    active_plugin_name_ = plugin_name;
+    // the next negotiations use the modes of the new plugin
+    config_available_control_modes(modes_file.parent_path());
+    response->success = true;
+  };
+
   void mode_timer_callback()
   {
     as2_msgs::msg::ControllerInfo msg;
     msg.header.stamp = this->now();
+    // the mode snapshot, the negotiation updates the modes from the service thread
     msg.current_control_mode = controller_->getMode();
     mode_pub_->publish(msg);
   };
 
-public:
-  double cmd_freq_;
-
 private:
   double info_freq_;
   std::filesystem::path plugin_name_;
   std::filesystem::path available_modes_config_file_;
 
-  std::shared_ptr<pluginlib::ClassLoader<controller_plugin_base::ControllerBase>> loader_;
+  // declared before the controller so the plugin is destroyed while its library is loaded
+  std::shared_ptr<ControllerLoader> loader_;
   std::shared_ptr<controller_plugin_base::ControllerBase> controller_;
   rclcpp::Publisher<as2_msgs::msg::ControllerInfo>::SharedPtr mode_pub_;
   rclcpp::TimerBase::SharedPtr mode_timer_;
+  rclcpp::Service<std_srvs::srv::Trigger>::SharedPtr swap_plugin_srv_;
+  std::string active_plugin_name_;
+  std::map<std::string, std::shared_ptr<controller_plugin_base::ControllerBase>> standby_plugins_;
 };
 
 #endif // CONTROLLER_MANAGER_HPP
@@ -0,0 +1,179 @@
+/*!*******************************************************************************************
+ *  \file       modes_cache.hpp
+ *  \brief      Binary cache of the control modes parsed from the plugin manifests
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef MODES_CACHE_HPP
+#define MODES_CACHE_HPP
+
+#include <unistd.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+namespace modes_cache
+{
+
+constexpr uint32_t MAGIC   = 0x4D325341;  // "AS2M"
+constexpr uint8_t VERSION  = 1;
+
+// FNV-1a 64 bits
+inline uint64_t hash(const std::string& data)
+{
+  uint64_t value = 0xcbf29ce484222325ULL;
+  for (const unsigned char c : data)
+  {
+    value ^= c;
+    value *= 0x100000001b3ULL;
+  }
+  return value;
+}
+
+inline bool readFile(const std::filesystem::path& path, std::string& data)
+{
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+  {
+    return false;
+  }
+  data.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+  return true;
+}
+
+// $ROS_HOME/controller_manager, ~/.ros/controller_manager by default. Installed plugin
+// directories are usually read only
+inline std::filesystem::path directory()
+{
+  if (const char* ros_home = std::getenv("ROS_HOME"))
+  {
+    return std::filesystem::path(ros_home) / "controller_manager";
+  }
+  const char* home = std::getenv("HOME");
+  return std::filesystem::path(home ? home : "/tmp") / ".ros" / "controller_manager";
+}
+
+inline std::filesystem::path entryPath(const uint64_t key)
+{
+  char name[32];
+  std::snprintf(name, sizeof(name), "%016llx.modes", static_cast<unsigned long long>(key));
+  return directory() / name;
+}
+
+// layout: magic u32, version u8, key u64, n u8, n input modes, n u8, n output modes
+inline bool load(const uint64_t key, std::vector<uint8_t>& input_modes,
+                 std::vector<uint8_t>& output_modes)
+{
+  std::string data;
+  if (!readFile(entryPath(key), data) || data.size() < 15)
+  {
+    return false;
+  }
+  uint32_t magic;
+  uint64_t stored_key;
+  std::memcpy(&magic, data.data(), sizeof(magic));
+  std::memcpy(&stored_key, data.data() + 5, sizeof(stored_key));
+  if (magic != MAGIC || static_cast<uint8_t>(data[4]) != VERSION || stored_key != key)
+  {
+    return false;
+  }
+
+  size_t offset = 13;
+  auto read_modes = [&data, &offset](std::vector<uint8_t>& modes)
+  {
+    if (offset >= data.size())
+    {
+      return false;
+    }
+    const size_t n = static_cast<uint8_t>(data[offset++]);
+    if (offset + n > data.size())
+    {
+      return false;
+    }
+    modes.assign(data.begin() + offset, data.begin() + offset + n);
+    offset += n;
+    return true;
+  };
+  return read_modes(input_modes) && read_modes(output_modes);
+}
+
+// best effort, a failed write only means parsing again next time
+inline void store(const uint64_t key, const std::vector<uint8_t>& input_modes,
+                  const std::vector<uint8_t>& output_modes)
+{
+  std::error_code error;
+  std::filesystem::create_directories(directory(), error);
+  if (error || input_modes.size() > 255 || output_modes.size() > 255)
+  {
+    return;
+  }
+
+  std::string data(13, '\0');
+  std::memcpy(&data[0], &MAGIC, sizeof(MAGIC));
+  data[4] = static_cast<char>(VERSION);
+  std::memcpy(&data[5], &key, sizeof(key));
+  for (const auto* modes : {&input_modes, &output_modes})
+  {
+    data.push_back(static_cast<char>(modes->size()));
+    data.append(modes->begin(), modes->end());
+  }
+
+  // written aside and renamed, so concurrent readers never see a partial entry
+  const auto path = entryPath(key);
+  auto tmp_path   = path;
+  tmp_path += "." + std::to_string(::getpid());
+  {
+    std::ofstream file(tmp_path, std::ios::binary | std::ios::trunc);
+    file.write(data.data(), data.size());
+    if (!file)
+    {
+      return;
+    }
+  }
+  std::filesystem::rename(tmp_path, path, error);
+  if (error)
+  {
+    std::filesystem::remove(tmp_path, error);
+  }
+}
+
+}  // namespace modes_cache
+
+#endif  // MODES_CACHE_HPP
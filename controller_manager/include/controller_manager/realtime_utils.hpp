@@ -0,0 +1,107 @@
+/*!*******************************************************************************************
+ *  \file       realtime_utils.hpp
+ *  \brief      Helpers to run the controller manager executors with real-time settings
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+
+#ifndef REALTIME_UTILS_HPP
+#define REALTIME_UTILS_HPP
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+namespace realtime_utils
+{
+
+// Lock current and future pages in RAM so the control loop never page faults
+inline bool lockMemory(std::string& error)
+{
+  if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+  {
+    error = std::strerror(errno);
+    return false;
+  }
+  return true;
+}
+
+// Touch the stack of the calling thread so its pages are mapped before the first tick
+inline void prefaultStack()
+{
+  constexpr std::size_t prefault_size = 512 * 1024;
+  volatile unsigned char stack[prefault_size];
+  for (std::size_t i = 0; i < prefault_size; i += 4096)
+  {
+    stack[i] = 0;
+  }
+}
+
+// Set SCHED_FIFO priority (0 keeps SCHED_OTHER) and pin the thread to cpu (-1 keeps any cpu)
+inline bool configureThread(pthread_t thread, int priority, int cpu, std::string& error)
+{
+  if (priority > 0)
+  {
+    sched_param param;
+    param.sched_priority = priority;
+    int ret = pthread_setschedparam(thread, SCHED_FIFO, &param);
+    if (ret != 0)
+    {
+      error = "SCHED_FIFO: " + std::string(std::strerror(ret));
+      return false;
+    }
+  }
+
+  if (cpu >= 0)
+  {
+    cpu_set_t cpuset;
+    CPU_ZERO(&cpuset);
+    CPU_SET(cpu, &cpuset);
+    int ret = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
+    if (ret != 0)
+    {
+      error = "CPU affinity: " + std::string(std::strerror(ret));
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace realtime_utils
+
+#endif  // REALTIME_UTILS_HPP
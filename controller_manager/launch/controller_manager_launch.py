@@ -1,5 +1,6 @@
 from launch import LaunchDescription
-from launch_ros.actions import Node
+from launch_ros.actions import Node, LoadComposableNodes
+from launch_ros.descriptions import ComposableNode
 from launch.actions import DeclareLaunchArgument, OpaqueFunction
 from launch.substitutions import LaunchConfiguration, EnvironmentVariable, PathJoinSubstitution
 from launch_ros.substitutions import FindPackageShare
@@ -35,6 +36,24 @@ def get_controller_node(context, *args, **kwargs):
             'config', 'default_controller.yaml'
         ])
 
+    container = LaunchConfiguration('container').perform(context)
+    if container:
+        # load into an existing container with intra-process communication
+        load_node = LoadComposableNodes(
+            target_container=container,
+            composable_node_descriptions=[
+                ComposableNode(
+                    package='controller_manager',
+                    plugin='ControllerManager',
+                    name='controller_manager',
+                    namespace=LaunchConfiguration('drone_id'),
+                    parameters=[LaunchConfiguration('config'), plugin_config],
+                    extra_arguments=[{'use_intra_process_comms': True}]
+                )
+            ]
+        )
+        return [load_node]
+
     node = Node(
         package='controller_manager',
         executable='controller_manager_node',
@@ -56,6 +75,8 @@ def generate_launch_description():
     ld = LaunchDescription([
         DeclareLaunchArgument('drone_id', default_value=EnvironmentVariable('AEROSTACK2_SIMULATION_DRONE_ID')),
         DeclareLaunchArgument('config', default_value=config),
+        DeclareLaunchArgument('container', default_value='',
+                              description='Name of an existing component container to load into'),
         OpaqueFunction(function=get_controller_node)
     ])
 
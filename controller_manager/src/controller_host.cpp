@@ -0,0 +1,177 @@
+/*!*******************************************************************************************
+ *  \file       controller_host.cpp
+ *  \brief      Hosts the controller managers of several vehicles in a single process
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#include <yaml-cpp/yaml.h>
+
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <rclcpp/executors/multi_threaded_executor.hpp>
+
+#include "controller_manager/controller_manager.hpp"
+
+// One controller manager per vehicle namespace, all in one process: a single context and
+// DDS participant, one plugin loader and one executor thread pool shared by every vehicle
+
+static void printUsage() {
+  std::cout << "Usage: controller_host --config <host_config_file>" << std::endl;
+}
+
+int main(int argc, char* argv[]) {
+  setvbuf(stdout, NULL, _IONBF, BUFSIZ);
+  rclcpp::init(argc, argv);
+  const auto args = rclcpp::remove_ros_arguments(argc, argv);
+
+  std::string config_file;
+  for (size_t i = 1; i < args.size(); i++) {
+    if (args[i] == "--config" && i + 1 < args.size()) {
+      config_file = args[++i];
+    } else {
+      // unknown option, or --config without a file
+      printUsage();
+      rclcpp::shutdown();
+      return 1;
+    }
+  }
+  if (config_file.empty()) {
+    printUsage();
+    rclcpp::shutdown();
+    return 1;
+  }
+
+  YAML::Node config;
+  try {
+    config = YAML::LoadFile(config_file)["controller_host"];
+  } catch (const YAML::Exception& e) {
+    std::cerr << "Could not read " << config_file << ": " << e.what() << std::endl;
+    rclcpp::shutdown();
+    return 1;
+  }
+  const int threads             = config["threads"].as<int>(0);
+  const bool spread_phase       = config["spread_phase"].as<bool>(true);
+  const bool batch              = config["batch"].as<bool>(false);
+  const std::string params_file = config["params_file"].as<std::string>("");
+  const YAML::Node vehicles     = config["vehicles"];
+  if (!vehicles || !vehicles.IsSequence() || vehicles.size() == 0) {
+    std::cerr << "No vehicles defined in " << config_file << std::endl;
+    rclcpp::shutdown();
+    return 1;
+  }
+
+  auto loader = std::make_shared<ControllerManager::ControllerLoader>(
+      "controller_plugin_base", "controller_plugin_base::ControllerBase");
+
+  std::vector<std::shared_ptr<ControllerManager>> managers;
+  managers.reserve(vehicles.size());
+  for (size_t i = 0; i < vehicles.size(); i++) {
+    const std::string ns = vehicles[i]["namespace"].as<std::string>();
+
+    // every vehicle gets its own namespace and parameters, command line remaps would apply to all
+    std::vector<std::string> arguments = {"--ros-args", "-r", "__ns:=/" + ns};
+    if (!params_file.empty()) {
+      arguments.insert(arguments.end(), {"--params-file", params_file});
+    }
+    const std::string vehicle_params = vehicles[i]["params_file"].as<std::string>("");
+    if (!vehicle_params.empty()) {
+      arguments.insert(arguments.end(), {"--params-file", vehicle_params});
+    }
+
+    rclcpp::NodeOptions options;
+    options.use_global_arguments(false);
+    options.arguments(arguments);
+    if (batch) {
+      // ticked together by the host
+      options.parameter_overrides({rclcpp::Parameter("control_loop_trigger", "external")});
+    } else if (spread_phase) {
+      // ticks evenly spread over the control period
+      options.parameter_overrides(
+          {rclcpp::Parameter("control_phase", static_cast<double>(i) / vehicles.size())});
+    }
+    managers.emplace_back(std::make_shared<ControllerManager>(options, loader));
+  }
+
+  // batch mode: one tick per plugin type, computing all its vehicles in a single call
+  struct BatchGroup {
+    std::vector<controller_plugin_base::ControllerBase*> controllers;
+    controller_plugin_base::BatchWorkspace workspace;
+    rclcpp::TimerBase::SharedPtr timer;
+  };
+  std::map<std::string, BatchGroup> batch_groups;
+  if (batch) {
+    for (auto& manager : managers) {
+      const std::string plugin_name = manager->get_parameter("plugin_name").as_string();
+      batch_groups[plugin_name].controllers.push_back(manager->getController().get());
+    }
+    for (auto& [plugin_name, group] : batch_groups) {
+      group.workspace.reserve(group.controllers.size());
+      // the group is ticked from the node of its first vehicle, at that vehicle rate
+      auto host_node = managers.front();
+      for (auto& manager : managers) {
+        if (manager->getController().get() == group.controllers.front()) {
+          host_node = manager;
+        }
+      }
+      const double freq = group.controllers.front()->getControlFrequency();
+      group.timer       = rclcpp::create_timer(
+          host_node, host_node->get_clock(), rclcpp::Duration::from_seconds(1.0 / freq),
+          [&group]() {
+            controller_plugin_base::ControllerBase::controlTickBatch(group.controllers,
+                                                                     group.workspace);
+          },
+          host_node->getController()->getControlCallbackGroup());
+      RCLCPP_INFO(host_node->get_logger(), "Batch of %zu %s controllers at %.1f Hz",
+                  group.controllers.size(), plugin_name.c_str(), freq);
+    }
+  }
+
+  // each controller keeps its callbacks in mutually exclusive groups, so a vehicle never runs
+  // two ticks at once while different vehicles are served by different workers
+  rclcpp::executors::MultiThreadedExecutor executor(rclcpp::ExecutorOptions(), threads);
+  for (auto& manager : managers) {
+    executor.add_node(manager);
+  }
+  RCLCPP_INFO(managers.front()->get_logger(), "Hosting %zu controllers on %zu threads",
+              managers.size(), executor.get_number_of_threads());
+  executor.spin();
+
+  batch_groups.clear();
+  managers.clear();
+  rclcpp::shutdown();
+  return 0;
+}
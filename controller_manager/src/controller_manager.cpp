@@ -36,15 +36,104 @@
 
 
 #include "controller_manager/controller_manager.hpp"
-#include "as2_core/core_functions.hpp"
+#include "controller_manager/realtime_utils.hpp"
+
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Spin the control loop, the input ingestion and the rest of callbacks on separate executors
+void spinRealtime(std::shared_ptr<ControllerManager> node) {
+  int control_priority, control_cpu, input_priority, input_cpu;
+  node->get_parameter("realtime.control_priority", control_priority);
+  node->get_parameter("realtime.control_cpu", control_cpu);
+  node->get_parameter("realtime.input_priority", input_priority);
+  node->get_parameter("realtime.input_cpu", input_cpu);
+
+  std::string error;
+  if (!realtime_utils::lockMemory(error)) {
+    RCLCPP_WARN(node->get_logger(), "mlockall failed: %s", error.c_str());
+  }
+
+  auto controller = node->getController();
+  rclcpp::executors::SingleThreadedExecutor control_executor;
+  rclcpp::executors::SingleThreadedExecutor input_executor;
+  rclcpp::executors::SingleThreadedExecutor service_executor;
+  control_executor.add_callback_group(controller->getControlCallbackGroup(),
+                                      node->get_node_base_interface());
+  input_executor.add_callback_group(controller->getInputCallbackGroup(),
+                                    node->get_node_base_interface());
+  // slower stages of multi-rate plugins, preempted by the control thread on its cpu
+  const auto& stages = controller->getComputeStages();
+  std::vector<std::unique_ptr<rclcpp::executors::SingleThreadedExecutor>> stage_executors;
+  for (const auto& stage : stages) {
+    stage_executors.push_back(std::make_unique<rclcpp::executors::SingleThreadedExecutor>());
+    stage_executors.back()->add_callback_group(stage->callback_group,
+                                               node->get_node_base_interface());
+  }
+  // services, info timer and parameter handling: every group not taken above
+  service_executor.add_node(node);
+
+  std::thread control_thread([&control_executor]() {
+    realtime_utils::prefaultStack();
+    control_executor.spin();
+  });
+  std::thread input_thread([&input_executor]() {
+    realtime_utils::prefaultStack();
+    input_executor.spin();
+  });
+
+  if (!realtime_utils::configureThread(control_thread.native_handle(), control_priority,
+                                       control_cpu, error)) {
+    RCLCPP_WARN(node->get_logger(), "Control thread real-time setup failed: %s", error.c_str());
+  }
+  if (!realtime_utils::configureThread(input_thread.native_handle(), input_priority, input_cpu,
+                                       error)) {
+    RCLCPP_WARN(node->get_logger(), "Input thread real-time setup failed: %s", error.c_str());
+  }
+  std::vector<std::thread> stage_threads;
+  for (size_t i = 0; i < stage_executors.size(); i++) {
+    auto& executor = *stage_executors[i];
+    stage_threads.emplace_back([&executor]() {
+      realtime_utils::prefaultStack();
+      executor.spin();
+    });
+    if (!realtime_utils::configureThread(stage_threads.back().native_handle(),
+                                         stages[i]->priority, control_cpu, error)) {
+      RCLCPP_WARN(node->get_logger(), "Stage %s thread real-time setup failed: %s",
+                  stages[i]->name.c_str(), error.c_str());
+    }
+  }
+  RCLCPP_INFO(node->get_logger(), "Real-time executors running (control priority %d, cpu %d)",
+              control_priority, control_cpu);
+
+  service_executor.spin();
+
+  control_executor.cancel();
+  input_executor.cancel();
+  for (auto& executor : stage_executors) {
+    executor->cancel();
+  }
+  control_thread.join();
+  input_thread.join();
+  for (auto& thread : stage_threads) {
+    thread.join();
+  }
+}
 
 int main(int argc, char* argv[]) {
   setvbuf(stdout, NULL, _IONBF, BUFSIZ);
   rclcpp::init(argc, argv);
 
   auto node = std::make_shared<ControllerManager>();
-  node->preset_loop_frequency(node->cmd_freq_);
-  as2::spinLoop(node);
+  bool use_realtime = false;
+  node->get_parameter("realtime.enabled", use_realtime);
+  if (use_realtime) {
+    spinRealtime(node);
+  } else {
+    // the control loop is scheduled by the controller timer (publish_cmd_freq)
+    rclcpp::spin(node);
+  }
 
   rclcpp::shutdown();
   return 0;
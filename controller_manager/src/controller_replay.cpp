@@ -0,0 +1,240 @@
+/*!*******************************************************************************************
+ *  \file       controller_replay.cpp
+ *  \brief      Offline replay of recorded flights through a controller plugin
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ * 
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ * 
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+
+#include <rcl/time.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+
+#include <as2_core/control_mode_utils/control_mode_utils.hpp>
+#include <as2_core/names/topics.hpp>
+#include <as2_core/node.hpp>
+#include <pluginlib/class_loader.hpp>
+#include <rclcpp/context.hpp>
+#include <rclcpp/serialization.hpp>
+#include <rosbag2_cpp/reader.hpp>
+
+#include "controller_plugin_base/controller_base.hpp"
+
+// Feeds a recorded bag straight into a controller plugin, without transport nor executors,
+// and writes every computed command with its timing as csv. The plugin is set up as a standby
+// one, so nothing is created on the middleware besides the node
+
+static void printUsage() {
+  std::cout << "Usage: controller_replay --bag <bag_path> --plugin <plugin_name>"
+               " --input-mode <uint8> --output-mode <uint8> [--params <params_file>]"
+               " [--output <csv_file>]"
+            << std::endl;
+}
+
+static bool endsWith(const std::string& str, const std::string& suffix) {
+  return str.size() >= suffix.size() &&
+         str.compare(str.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+template <typename MessageT>
+static MessageT deserialize(const rosbag2_storage::SerializedBagMessage& bag_msg) {
+  static rclcpp::Serialization<MessageT> serialization;
+  rclcpp::SerializedMessage serialized_msg(*bag_msg.serialized_data);
+  MessageT msg;
+  serialization.deserialize_message(&serialized_msg, &msg);
+  return msg;
+}
+
+static int64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() -
+                                                              start)
+      .count();
+}
+
+int main(int argc, char* argv[]) {
+  std::string bag_path, plugin_name, params_file;
+  std::string output_file = "controller_replay.csv";
+  int input_mode = -1, output_mode = -1;
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    // every option takes a value
+    if (i + 1 >= argc) {
+      printUsage();
+      return 1;
+    }
+    const std::string value = argv[++i];
+    if (arg == "--bag") {
+      bag_path = value;
+    } else if (arg == "--plugin") {
+      plugin_name = value;
+    } else if (arg == "--params") {
+      params_file = value;
+    } else if (arg == "--output") {
+      output_file = value;
+    } else if (arg == "--input-mode") {
+      input_mode = std::stoi(value, nullptr, 0);
+    } else if (arg == "--output-mode") {
+      output_mode = std::stoi(value, nullptr, 0);
+    } else {
+      printUsage();
+      return 1;
+    }
+  }
+  if (bag_path.empty() || plugin_name.empty() || input_mode < 0 || output_mode < 0) {
+    printUsage();
+    return 1;
+  }
+
+  // the node is only used for the plugin parameters and clock, it is never spun. Its own
+  // context, without parameter services nor rosout, keeps it apart from a live system
+  auto context = std::make_shared<rclcpp::Context>();
+  context->init(1, argv);
+  rclcpp::NodeOptions options;
+  options.context(context)
+      .use_global_arguments(false)
+      .start_parameter_services(false)
+      .start_parameter_event_publisher(false)
+      .enable_rosout(false);
+  if (!params_file.empty()) {
+    options.arguments({"--ros-args", "--params-file", params_file});
+  }
+  auto node = std::make_shared<as2::Node>("controller_replay", options);
+
+  pluginlib::ClassLoader<controller_plugin_base::ControllerBase> loader(
+      "controller_plugin_base", "controller_plugin_base::ControllerBase");
+  std::shared_ptr<controller_plugin_base::ControllerBase> controller;
+  try {
+    controller = loader.createSharedInstance(plugin_name + "::Plugin");
+  } catch (pluginlib::PluginlibException& ex) {
+    RCLCPP_FATAL(node->get_logger(), "The plugin failed to load: %s", ex.what());
+    context->shutdown("replay failed");
+    return 1;
+  }
+  // replay path: only the plugin setup, no subscriptions, publishers nor timers
+  controller->initializeStandby(node.get());
+  if (!controller->setMode(as2::convertUint8tToAS2ControlMode(input_mode),
+                           as2::convertUint8tToAS2ControlMode(output_mode))) {
+    RCLCPP_FATAL(node->get_logger(), "Plugin rejected the control mode");
+    context->shutdown("replay failed");
+    return 1;
+  }
+
+  // the node clock follows the bag time, so plugins using now() see the recorded timing
+  rcl_clock_t* clock_handle = node->get_clock()->get_clock_handle();
+  rcl_enable_ros_time_override(clock_handle);
+
+  rosbag2_cpp::Reader reader;
+  reader.open(bag_path);
+
+  std::ofstream output(output_file);
+  output << "time_ns,update_state_ns,compute_ns,"
+            "pose_x,pose_y,pose_z,pose_qx,pose_qy,pose_qz,pose_qw,"
+            "twist_vx,twist_vy,twist_vz,twist_wx,twist_wy,twist_wz,thrust\n";
+
+  geometry_msgs::msg::PoseStamped pose;
+  geometry_msgs::msg::TwistStamped twist;
+  bool twist_received = false;
+  geometry_msgs::msg::PoseStamped cmd_pose;
+  geometry_msgs::msg::TwistStamped cmd_twist;
+  as2_msgs::msg::Thrust cmd_thrust;
+  size_t n_commands = 0, n_references = 0;
+  int64_t reference_ns = 0;
+
+  const auto replay_start = std::chrono::steady_clock::now();
+  while (reader.has_next()) {
+    auto bag_msg             = reader.read_next();
+    const std::string& topic = bag_msg->topic_name;
+    rcl_set_ros_time_override(clock_handle, bag_msg->time_stamp);
+
+    if (endsWith(topic, as2_names::topics::self_localization::twist)) {
+      twist          = deserialize<geometry_msgs::msg::TwistStamped>(*bag_msg);
+      twist_received = true;
+    } else if (endsWith(topic, as2_names::topics::self_localization::pose)) {
+      // a control step for every pose, with the latest twist
+      pose = deserialize<geometry_msgs::msg::PoseStamped>(*bag_msg);
+      if (!twist_received) {
+        continue;
+      }
+      auto start = std::chrono::steady_clock::now();
+      controller->updateState(pose, twist);
+      const int64_t update_state_ns = elapsedNs(start);
+
+      start = std::chrono::steady_clock::now();
+      controller->computeOutput(cmd_pose, cmd_twist, cmd_thrust);
+      const int64_t compute_ns = elapsedNs(start);
+      n_commands++;
+
+      const auto& p  = cmd_pose.pose;
+      const auto& tw = cmd_twist.twist;
+      output << bag_msg->time_stamp << "," << update_state_ns << "," << compute_ns << ","
+             << p.position.x << "," << p.position.y << "," << p.position.z << ","
+             << p.orientation.x << "," << p.orientation.y << "," << p.orientation.z << ","
+             << p.orientation.w << "," << tw.linear.x << "," << tw.linear.y << ","
+             << tw.linear.z << "," << tw.angular.x << "," << tw.angular.y << ","
+             << tw.angular.z << "," << cmd_thrust.thrust << "\n";
+    } else if (endsWith(topic, as2_names::topics::motion_reference::pose)) {
+      auto ref   = deserialize<geometry_msgs::msg::PoseStamped>(*bag_msg);
+      auto start = std::chrono::steady_clock::now();
+      controller->updateReference(ref);
+      reference_ns += elapsedNs(start);
+      n_references++;
+    } else if (endsWith(topic, as2_names::topics::motion_reference::twist)) {
+      auto ref   = deserialize<geometry_msgs::msg::TwistStamped>(*bag_msg);
+      auto start = std::chrono::steady_clock::now();
+      controller->updateReference(ref);
+      reference_ns += elapsedNs(start);
+      n_references++;
+    } else if (endsWith(topic, as2_names::topics::motion_reference::trajectory)) {
+      auto ref   = deserialize<trajectory_msgs::msg::JointTrajectoryPoint>(*bag_msg);
+      auto start = std::chrono::steady_clock::now();
+      controller->updateReference(ref);
+      reference_ns += elapsedNs(start);
+      n_references++;
+    }
+  }
+
+  const double replay_s = elapsedNs(replay_start) / 1e9;
+  RCLCPP_INFO(node->get_logger(),
+              "Replayed %zu commands and %zu references in %.3f s (mean updateReference %.2f us),"
+              " written to %s",
+              n_commands, n_references, replay_s,
+              n_references ? reference_ns / 1e3 / n_references : 0.0, output_file.c_str());
+
+  controller.reset();
+  context->shutdown("replay done");
+  return 0;
+}
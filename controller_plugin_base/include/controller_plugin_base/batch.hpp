@@ -0,0 +1,160 @@
+/********************************************************************************************
+ *  \file       batch.hpp
+ *  \brief      Structure of arrays batches used by the batch control interface
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef BATCH_HPP
+#define BATCH_HPP
+
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "geometry_msgs/msg/pose.hpp"
+#include "geometry_msgs/msg/twist.hpp"
+
+namespace controller_plugin_base {
+
+class ControllerBase;
+
+/**
+ * Pose and twist of several vehicles, one row per vehicle and one contiguous array per
+ * component so batch kernels can vectorize across the rows.
+ */
+struct PoseTwistBatch {
+  std::vector<double> position_x, position_y, position_z;
+  std::vector<double> orientation_x, orientation_y, orientation_z, orientation_w;
+  std::vector<double> linear_x, linear_y, linear_z;
+  std::vector<double> angular_x, angular_y, angular_z;
+
+  size_t size() const { return position_x.size(); }
+
+  void reserve(const size_t n) {
+    for (auto* component : components()) component->reserve(n);
+  }
+
+  // no allocation while n stays within the reserved capacity
+  void resize(const size_t n) {
+    for (auto* component : components()) component->resize(n);
+  }
+
+  void set(const size_t i, const geometry_msgs::msg::Pose& pose,
+           const geometry_msgs::msg::Twist& twist) {
+    position_x[i]    = pose.position.x;
+    position_y[i]    = pose.position.y;
+    position_z[i]    = pose.position.z;
+    orientation_x[i] = pose.orientation.x;
+    orientation_y[i] = pose.orientation.y;
+    orientation_z[i] = pose.orientation.z;
+    orientation_w[i] = pose.orientation.w;
+    linear_x[i]      = twist.linear.x;
+    linear_y[i]      = twist.linear.y;
+    linear_z[i]      = twist.linear.z;
+    angular_x[i]     = twist.angular.x;
+    angular_y[i]     = twist.angular.y;
+    angular_z[i]     = twist.angular.z;
+  }
+
+  void get(const size_t i, geometry_msgs::msg::Pose& pose, geometry_msgs::msg::Twist& twist) const {
+    pose.position.x    = position_x[i];
+    pose.position.y    = position_y[i];
+    pose.position.z    = position_z[i];
+    pose.orientation.x = orientation_x[i];
+    pose.orientation.y = orientation_y[i];
+    pose.orientation.z = orientation_z[i];
+    pose.orientation.w = orientation_w[i];
+    twist.linear.x     = linear_x[i];
+    twist.linear.y     = linear_y[i];
+    twist.linear.z     = linear_z[i];
+    twist.angular.x    = angular_x[i];
+    twist.angular.y    = angular_y[i];
+    twist.angular.z    = angular_z[i];
+  }
+
+  private:
+  std::array<std::vector<double>*, 13> components() {
+    return {&position_x,    &position_y,    &position_z, &orientation_x, &orientation_y,
+            &orientation_z, &orientation_w, &linear_x,   &linear_y,      &linear_z,
+            &angular_x,     &angular_y,     &angular_z};
+  }
+};
+
+/**
+ * Commands of several vehicles. Frames are initialized with the frames of the state of each
+ * vehicle, kernels only need to write them when they command in a different frame.
+ */
+struct CommandBatch : public PoseTwistBatch {
+  std::vector<double> thrust;
+  std::vector<std::string> pose_frame_id, twist_frame_id;
+
+  void reserve(const size_t n) {
+    PoseTwistBatch::reserve(n);
+    thrust.reserve(n);
+    pose_frame_id.reserve(n);
+    twist_frame_id.reserve(n);
+  }
+
+  void resize(const size_t n) {
+    PoseTwistBatch::resize(n);
+    thrust.resize(n);
+    pose_frame_id.resize(n);
+    twist_frame_id.resize(n);
+  }
+};
+
+/**
+ * Buffers reused by ControllerBase::controlTickBatch between ticks. Reserve them for the
+ * number of hosted controllers so the ticks do not allocate.
+ */
+struct BatchWorkspace {
+  std::vector<ControllerBase*> active;
+  std::vector<std::unique_lock<std::mutex>> locks;
+  PoseTwistBatch state;
+  PoseTwistBatch reference;
+  CommandBatch command;
+
+  void reserve(const size_t n) {
+    active.reserve(n);
+    locks.reserve(n);
+    state.reserve(n);
+    reference.reserve(n);
+    command.reserve(n);
+  }
+};
+
+}  // namespace controller_plugin_base
+
+#endif  // BATCH_HPP
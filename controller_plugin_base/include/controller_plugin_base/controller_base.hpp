@@ -40,21 +40,31 @@
 #define CONTROLLER_BASE_HPP
 
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <as2_core/control_mode_utils/control_mode_utils.hpp>
 #include <as2_core/names/topics.hpp>
-#include <as2_core/synchronous_service_client.hpp>
+#include <bitset>
 #include <cstdint>
 #include <fstream>
+#include <functional>
+#include <mutex>
+#include <memory>
+#include <optional>
+#include <rclcpp/client.hpp>
 #include <rclcpp/logging.hpp>
+#include <rclcpp/callback_group.hpp>
+#include <rclcpp/create_timer.hpp>
 #include <rclcpp/service.hpp>
+#include <rclcpp/time.hpp>
 #include <rclcpp/timer.hpp>
+#include <string>
 #include <vector>
 
 #include "as2_core/control_mode_utils/control_mode_utils.hpp"
 #include "as2_core/names/services.hpp"
 #include "as2_core/names/topics.hpp"
 #include "as2_core/node.hpp"
-#include "as2_core/synchronous_service_client.hpp"
 #include "as2_msgs/msg/control_mode.hpp"
 #include "as2_msgs/msg/platform_info.hpp"
 #include "as2_msgs/msg/thrust.hpp"
@@ -62,15 +72,32 @@
 #include "as2_msgs/srv/set_control_mode.hpp"
 #include "geometry_msgs/msg/pose_stamped.hpp"
 #include "geometry_msgs/msg/twist_stamped.hpp"
+#include "nav_msgs/msg/odometry.hpp"
+#include "trajectory_msgs/msg/joint_trajectory.hpp"
 #include "trajectory_msgs/msg/joint_trajectory_point.hpp"
+#include "controller_plugin_base/batch.hpp"
+#include "controller_plugin_base/flight_recorder.hpp"
+#include "controller_plugin_base/message_pool.hpp"
+#include "controller_plugin_base/shm_transport.hpp"
+#include "controller_plugin_base/snapshot_buffer.hpp"
+#include "controller_plugin_base/trajectory_buffer.hpp"
+#include "controller_plugin_base/timing_stats.hpp"
+#include "controller_plugin_base/tracing.hpp"
+#include "diagnostic_msgs/msg/diagnostic_array.hpp"
+#include "std_srvs/srv/trigger.hpp"
 #include <message_filters/subscriber.h>
 #include <message_filters/time_synchronizer.h>
 #include <message_filters/sync_policies/approximate_time.h>
+#include <message_filters/sync_policies/exact_time.h>
 
 #define MATCH_ALL 0b11111111
 #define MATCH_MODE_AND_FRAME 0b11110011
 #define MATCH_MODE 0b11110000
 
+#define POSE_COMMAND 0b001
+#define TWIST_COMMAND 0b010
+#define THRUST_COMMAND 0b100
+
 #define UNSET_MODE_MASK 0b00000000
 #define HOVER_MODE_MASK 0b00010000
 
@@ -86,24 +113,131 @@ class ControllerBase {
   std::shared_ptr<message_filters::Subscriber<geometry_msgs::msg::TwistStamped>> twist_sub_;
   typedef message_filters::sync_policies::ApproximateTime<geometry_msgs::msg::PoseStamped, geometry_msgs::msg::TwistStamped> approximate_policy;
   std::shared_ptr<message_filters::Synchronizer<approximate_policy>> synchronizer_;
-
-  rclcpp::Subscription<geometry_msgs::msg::PoseStamped>::SharedPtr ref_pose_sub_;
-  rclcpp::Subscription<geometry_msgs::msg::TwistStamped>::SharedPtr ref_twist_sub_;
-  rclcpp::Subscription<as2_msgs::msg::PlatformInfo>::SharedPtr platform_info_sub_;
-  rclcpp::Subscription<trajectory_msgs::msg::JointTrajectoryPoint>::SharedPtr ref_traj_sub_;
-
-  rclcpp::Publisher<as2_msgs::msg::Thrust>::SharedPtr thrust_pub_;
-  rclcpp::Publisher<geometry_msgs::msg::PoseStamped>::SharedPtr pose_pub_;
-  rclcpp::Publisher<geometry_msgs::msg::TwistStamped>::SharedPtr twist_pub_;
+  typedef message_filters::sync_policies::ExactTime<geometry_msgs::msg::PoseStamped, geometry_msgs::msg::TwistStamped> exact_policy;
+  std::shared_ptr<message_filters::Synchronizer<exact_policy>> exact_synchronizer_;
+
+  // unsynchronized state inputs, used by the latest and interpolate policies
+  PooledSubscription<geometry_msgs::msg::PoseStamped>::SharedPtr state_pose_sub_;
+  PooledSubscription<geometry_msgs::msg::TwistStamped>::SharedPtr state_twist_sub_;
+  PooledSubscription<nav_msgs::msg::Odometry>::SharedPtr odometry_sub_;
+  // the state halves split out of the odometry messages
+  MessageRing<geometry_msgs::msg::PoseStamped> odometry_poses_;
+  MessageRing<geometry_msgs::msg::TwistStamped> odometry_twists_;
+
+  PooledSubscription<geometry_msgs::msg::PoseStamped>::SharedPtr ref_pose_sub_;
+  PooledSubscription<geometry_msgs::msg::TwistStamped>::SharedPtr ref_twist_sub_;
+  PooledSubscription<as2_msgs::msg::PlatformInfo>::SharedPtr platform_info_sub_;
+  PooledSubscription<as2_msgs::msg::Thrust>::SharedPtr ref_thrust_sub_;
+  PooledSubscription<trajectory_msgs::msg::JointTrajectoryPoint>::SharedPtr ref_traj_sub_;
+  PooledSubscription<trajectory_msgs::msg::JointTrajectory>::SharedPtr ref_traj_batch_sub_;
+
+  // intra-process commands are allocated from these pools, the messages in flight point to
+  // them so they outlive the publishers
+  MessagePoolAllocator<as2_msgs::msg::Thrust> thrust_allocator_;
+  MessagePoolAllocator<geometry_msgs::msg::PoseStamped> pose_allocator_;
+  MessagePoolAllocator<geometry_msgs::msg::TwistStamped> twist_allocator_;
+
+  PooledPublisher<as2_msgs::msg::Thrust>::SharedPtr thrust_pub_;
+  PooledPublisher<geometry_msgs::msg::PoseStamped>::SharedPtr pose_pub_;
+  PooledPublisher<geometry_msgs::msg::TwistStamped>::SharedPtr twist_pub_;
+
+  rclcpp::CallbackGroup::SharedPtr control_callback_group_;
+  rclcpp::CallbackGroup::SharedPtr input_callback_group_;
+  rclcpp::CallbackGroup::SharedPtr service_callback_group_;
 
   rclcpp::Service<as2_msgs::srv::SetControlMode>::SharedPtr set_control_mode_srv_;
+  rclcpp::Service<as2_msgs::srv::ListControlModes>::SharedPtr list_compatible_modes_srv_;
   rclcpp::TimerBase::SharedPtr control_timer_;
+  // checks the graph after changes, the modes are fetched whenever the platform mode service
+  // appears or restarts
+  rclcpp::TimerBase::SharedPtr platform_discovery_timer_;
+  rclcpp::Event::SharedPtr platform_graph_event_;
+  bool platform_graph_checked_ = false;
+  bool platform_server_found_ = false;
+  std::array<uint8_t, RMW_GID_STORAGE_SIZE> platform_server_gid_{};
+  rclcpp::TimerBase::SharedPtr control_start_timer_;
+
+  rclcpp::Client<as2_msgs::srv::SetControlMode>::SharedPtr set_control_mode_client_;
+  rclcpp::Client<as2_msgs::srv::ListControlModes>::SharedPtr list_control_modes_client_;
+
+  enum class ModeNegotiationState { IDLE, LISTING_PLATFORM_MODES, SETTING_PLATFORM_MODE };
+
+  struct ModeNegotiation {
+    std::shared_ptr<rmw_request_id_t> request_header;
+    as2_msgs::msg::ControlMode requested_mode;
+    as2_msgs::msg::ControlMode mode_to_request;
+    uint8_t input_mode_desired = 0;
+    bool bypass = false;
+  };
 
-  as2_msgs::msg::PlatformInfo platform_info_;
-
-  as2::SynchronousServiceClient<as2_msgs::srv::SetControlMode>::SharedPtr set_control_mode_client_;
-  as2::SynchronousServiceClient<as2_msgs::srv::ListControlModes>::SharedPtr
-      list_control_modes_client_;
+  ModeNegotiationState negotiation_state_ = ModeNegotiationState::IDLE;
+  ModeNegotiation negotiation_;
+  uint64_t negotiation_id_ = 0;
+  double mode_negotiation_timeout_ = 2.0;  // seconds
+  rclcpp::TimerBase::SharedPtr negotiation_timeout_timer_;
+  // held by the control tick, taken to swap modes between ticks
+  std::mutex mode_mutex_;
+
+  double cmd_freq_ = 100.0;
+  bool control_on_state_ = false;
+  rclcpp::Duration control_period_ = rclcpp::Duration::from_seconds(0.01);
+  rclcpp::Time next_deadline_;
+  std::atomic<uint64_t> overrun_count_{0};
+  std::atomic<uint64_t> missed_tick_count_{0};
+  // rate the control loop runs at, publish_cmd_freq unless the governor stepped it down
+  std::atomic<double> control_freq_{100.0};
+
+  // rate governor: under load the control rate is stepped down within the plugin bounds and,
+  // once at the lowest rate, the plugin is asked for cheaper fidelity levels. Both are stepped
+  // back up when there is headroom. Only touched with mode_mutex_ held
+  struct RateGovernor {
+    bool enabled = false;
+    double min_freq = 0.0;
+    double max_freq = 0.0;
+    double high_load = 0.8;  // mean compute over period that steps down
+    double low_load = 0.3;   // mean compute over period that steps up
+    double step = 0.8;       // rate factor of each step down
+    int fidelity_level = 0;
+    int calm_windows = 0;
+    int64_t window_start_ns = 0;
+    int64_t window_compute_ns = 0;
+    uint64_t window_ticks = 0;
+    uint64_t window_late_ticks = 0;
+  };
+  RateGovernor governor_;
+  std::atomic<int> fidelity_level_{0};
+
+  // control loop instrumentation, recorded by the control loop and read by the diagnostics timer
+  struct LoopStatistics {
+    LatencyHistogram state_age;
+    LatencyHistogram reference_age;
+    LatencyHistogram compute;
+    LatencyHistogram publish;
+    LatencyHistogram tick_jitter;
+    std::atomic<uint64_t> commands{0};
+  };
+  struct LoopStatisticsWindow {
+    LatencyHistogram::Window state_age;
+    LatencyHistogram::Window reference_age;
+    LatencyHistogram::Window compute;
+    LatencyHistogram::Window publish;
+    LatencyHistogram::Window tick_jitter;
+    uint64_t commands = 0;
+    uint64_t overruns = 0;
+    uint64_t missed_ticks = 0;
+  };
+  LoopStatistics loop_stats_;
+  LoopStatisticsWindow loop_stats_window_;
+  rclcpp::Time last_reference_stamp_;
+  double info_freq_ = 10.0;
+  rclcpp::Publisher<diagnostic_msgs::msg::DiagnosticArray>::SharedPtr diagnostics_pub_;
+  rclcpp::TimerBase::SharedPtr diagnostics_timer_;
+  std::function<void()> mode_change_callback_;
+  // modes for the other threads, updated under mode_mutex_ with them: input mode, output
+  // mode << 8 and bypass << 16
+  std::atomic<uint32_t> mode_snapshot_{0};
+  // a mode was established since the last diagnostics
+  std::atomic<bool> mode_changed_{false};
 
   bool control_mode_established_ = false;
   bool motion_reference_adquired_ = false;
@@ -114,6 +248,18 @@ class ControllerBase {
 
   uint8_t prefered_output_mode_ = 0b00000000;  // by default, no output mode is prefered
 
+  struct ControlModeDecision {
+    uint8_t output_mode = 0;
+    bool feasible = false;
+    bool bypass = false;
+  };
+
+  // [input_mode][output_mode] feasible pairs, rebuilt when any of the mode lists changes
+  std::array<std::bitset<256>, 256> control_mode_table_;
+  // mode to request to the platform for each input mode
+  std::array<ControlModeDecision, 256> control_mode_decisions_;
+  bool control_mode_table_ready_ = false;
+
   public:
   ControllerBase(){};
 
@@ -131,6 +277,9 @@ class ControllerBase {
   virtual void updateReference(const trajectory_msgs::msg::JointTrajectoryPoint& ref){};
   virtual void updateReference(const as2_msgs::msg::Thrust& ref){};
 
+  // the output messages are fresh on every tick when they are loaned or handed over
+  // intra-process, so every field of the output mode topics has to be set. Only those topics
+  // are published
   virtual void computeOutput(geometry_msgs::msg::PoseStamped& pose,
                              geometry_msgs::msg::TwistStamped& twist,
                              as2_msgs::msg::Thrust& thrust) = 0;
@@ -138,50 +287,347 @@ class ControllerBase {
   virtual bool setMode(const as2_msgs::msg::ControlMode& mode_in,
                        const as2_msgs::msg::ControlMode& mode_out) = 0;
 
-  as2_msgs::msg::ControlMode getMode() { return this->input_mode_; };
-
-  void setInputControlModesAvailables(const std::vector<uint8_t>& available_modes) {
-    controller_available_modes_in_ = available_modes;
-    // sort modes in ascending order
-    std::sort(controller_available_modes_in_.begin(), controller_available_modes_in_.end());
+  // what the controller was doing before a mode switch, null when not available
+  struct ModeHandoff {
+    as2_msgs::msg::ControlMode previous_input_mode;
+    as2_msgs::msg::ControlMode previous_output_mode;
+    bool previous_bypass = false;
+    const geometry_msgs::msg::PoseStamped* pose = nullptr;
+    const geometry_msgs::msg::TwistStamped* twist = nullptr;
+    // last command sent, by this plugin or forwarded while bypassing
+    const geometry_msgs::msg::PoseStamped* command_pose = nullptr;
+    const geometry_msgs::msg::TwistStamped* command_twist = nullptr;
+    const as2_msgs::msg::Thrust* command_thrust = nullptr;
   };
 
-  void setOutputControlModesAvailables(const std::vector<uint8_t>& available_modes) {
-    controller_available_modes_out_ = available_modes;
-    // sort modes in ascending order
-    std::sort(controller_available_modes_out_.begin(), controller_available_modes_out_.end());
+  // Optional parameter hot reload, called off the control thread with every parameter being
+  // set on the node. Ignore the ones the plugin does not own, validate the rest and hand the
+  // new values to computeOutput through a ParameterSnapshot. Returning false, with the reason,
+  // rejects the whole change
+  virtual bool updateParameters(const std::vector<rclcpp::Parameter>& parameters,
+                                std::string& reason) { return true; };
+
+  // Optional bumpless switch hook, called after a successful setMode and before the first tick
+  // in the new mode, e.g. to seed integrators from the last command. The last state has
+  // already been handed through updateState, so the first tick does not wait for a new one
+  virtual void onModeHandoff(const ModeHandoff& handoff){};
+
+  // Optional rate governor hooks. Control rates the plugin tolerates, false (the default) keeps
+  // the rate at publish_cmd_freq. The governor never goes above publish_cmd_freq
+  virtual bool getControlRateBounds(double& min_freq, double& max_freq) const { return false; };
+  // Level 0 is the nominal computation, every level above is cheaper. Always called between
+  // two ticks, returns false when the level is not supported
+  virtual bool setFidelityLevel(const int level) { return level == 0; };
+
+  // Optional batch interface for hosts running several controllers of the same plugin type.
+  // Row i of the batches belongs to controllers[i], this controller is one of them. The
+  // default computes each controller on its own through computeOutput
+  virtual void computeOutputBatch(const std::vector<ControllerBase*>& controllers,
+                                  const PoseTwistBatch& state,
+                                  const PoseTwistBatch& reference,
+                                  CommandBatch& command);
+
+  // One control tick of all the controllers with a single computeOutputBatch call. They must
+  // use control_loop_trigger external. The batch runs the plugin of the first one, members
+  // running another plugin class, e.g. after a swap, compute on their own
+  static void controlTickBatch(const std::vector<ControllerBase*>& controllers,
+                               BatchWorkspace& workspace);
+
+  // safe from any thread, the modes established by the last negotiation
+  as2_msgs::msg::ControlMode getMode() const {
+    return as2::convertUint8tToAS2ControlMode(mode_snapshot_.load(std::memory_order_acquire) & 0xFF);
   };
+  as2_msgs::msg::ControlMode getOutputMode() const {
+    return as2::convertUint8tToAS2ControlMode(
+        (mode_snapshot_.load(std::memory_order_acquire) >> 8) & 0xFF);
+  };
+  bool isBypassed() const { return (mode_snapshot_.load(std::memory_order_acquire) >> 16) & 1; };
+
+  // called from the service thread every time a new control mode is established
+  void setModeChangeCallback(std::function<void()> callback) { mode_change_callback_ = callback; };
+
+  // control loop timer
+  rclcpp::CallbackGroup::SharedPtr getControlCallbackGroup() const { return control_callback_group_; };
+  // state, reference and platform info subscriptions
+  rclcpp::CallbackGroup::SharedPtr getInputCallbackGroup() const { return input_callback_group_; };
+  // control mode service
+  rclcpp::CallbackGroup::SharedPtr getServiceCallbackGroup() const { return service_callback_group_; };
+
+  double getControlFrequency() const { return control_freq_; };
+  int getFidelityLevel() const { return fidelity_level_; };
+  // ticks that finished after the next deadline
+  uint64_t getControlOverrunCount() const { return overrun_count_; };
+  // deadlines skipped because a tick started more than one period late
+  uint64_t getControlMissedTickCount() const { return missed_tick_count_; };
+
+  // Plugin hot swap. A standby plugin only runs ownInitialize on the node, swapPlugin then
+  // makes it compute the commands of this controller from the next tick on, keeping this
+  // controller inputs, outputs and control mode. A null plugin swaps back to this one.
+  // Offline tools, e.g. controller_replay, drive a standby plugin directly
+  void initializeStandby(as2::Node* node_ptr);
+  // Rejected, with the reason, while a mode negotiation is pending or when the new plugin does
+  // not accept the current mode
+  bool swapPlugin(std::shared_ptr<ControllerBase> next_plugin, std::string& reason);
+
+  // extra compute stage of a multi-rate plugin, see addComputeStage
+  struct ComputeStage {
+    std::string name;
+    double freq = 0.0;
+    int priority = 0;
+    int64_t period_ns = 0;
+    std::function<void()> compute;
+    rclcpp::CallbackGroup::SharedPtr callback_group;
+    rclcpp::TimerBase::SharedPtr timer;
+    // held while computing, mode changes and swaps take it so they never overlap a stage
+    std::mutex mutex;
+    LatencyHistogram stats;
+    LatencyHistogram::Window stats_window;
+    std::atomic<uint64_t> overruns{0};
+    uint64_t window_overruns = 0;
+  };
+
+  // stages of the plugin computing the commands, hosts may spin each group on its own thread
+  const std::vector<std::unique_ptr<ComputeStage>>& getComputeStages() { return plugin().compute_stages_; };
+
+  void setInputControlModesAvailables(const std::vector<uint8_t>& available_modes);
+  void setOutputControlModesAvailables(const std::vector<uint8_t>& available_modes);
 
   virtual ~ControllerBase(){};
 
+  // inputs that changed since the previous tick, null when unchanged
+  struct TickInputs {
+    const geometry_msgs::msg::PoseStamped* pose = nullptr;
+    const geometry_msgs::msg::TwistStamped* twist = nullptr;
+    const geometry_msgs::msg::PoseStamped* ref_pose = nullptr;
+    const geometry_msgs::msg::TwistStamped* ref_twist = nullptr;
+    const as2_msgs::msg::Thrust* ref_thrust = nullptr;
+    const trajectory_msgs::msg::JointTrajectoryPoint* ref_traj = nullptr;
+  };
+
   protected:
   as2::Node* node_ptr_;
 
+  // one virtual call per tick handing the new inputs to updateState / updateReference.
+  // ControllerBaseT overrides it with statically dispatched calls
+  virtual void dispatchInputs(const TickInputs& inputs);
+  // the virtual call per tick running computeOutput, statically dispatched by ControllerBaseT
+  virtual void dispatchCompute(geometry_msgs::msg::PoseStamped& pose,
+                               geometry_msgs::msg::TwistStamped& twist,
+                               as2_msgs::msg::Thrust& thrust);
+
+  // update_reference entry and exit tracepoints around update, nothing when tracing is off
+  template <typename UpdateT>
+  void traceReference(const uint8_t topic, const builtin_interfaces::msg::Time& stamp, UpdateT&& update)
+  {
+    CONTROLLER_TRACEPOINT(update_reference_entry, this, topic, tracing::stampNs(stamp));
+    update();
+    CONTROLLER_TRACEPOINT(update_reference_exit, this, topic, tracing::stampNs(stamp));
+  }
+
+  // one control loop iteration, normally called by the control timer
+  void control_timer_callback();
+
+  // Multi-rate plugins: the slower stages of a cascade, e.g. a position loop feeding the
+  // attitude loop in computeOutput, run on their own timer and callback group at freq so they
+  // never delay the control tick. Stages run only while the controller computes commands and
+  // never during setMode. They exchange results with each other and with computeOutput
+  // through a Mailbox per direction. priority is the SCHED_FIFO priority of the stage thread
+  // when the host spins real-time executors. Call from ownInitialize
+  void addComputeStage(const std::string& name, const double freq, const int priority,
+                       std::function<void()> compute);
+
   private:
   void state_callback(const geometry_msgs::msg::PoseStamped::ConstSharedPtr pose_msg,
                       const geometry_msgs::msg::TwistStamped::ConstSharedPtr twist_msg);
-  void ref_pose_callback(const geometry_msgs::msg::PoseStamped::SharedPtr msg);
-  void ref_twist_callback(const geometry_msgs::msg::TwistStamped::SharedPtr msg);
-  void ref_traj_callback(const trajectory_msgs::msg::JointTrajectoryPoint::SharedPtr msg);
-  void platform_info_callback(const as2_msgs::msg::PlatformInfo::SharedPtr msg);
-
-  geometry_msgs::msg::PoseStamped pose_;
-  geometry_msgs::msg::TwistStamped twist_;
-  geometry_msgs::msg::PoseStamped ref_pose_;
-  geometry_msgs::msg::TwistStamped ref_twist_;
-  trajectory_msgs::msg::JointTrajectoryPoint ref_traj_;
+  void state_pose_callback(geometry_msgs::msg::PoseStamped::ConstSharedPtr msg);
+  void state_twist_callback(geometry_msgs::msg::TwistStamped::ConstSharedPtr msg);
+  void storeLatestState(const geometry_msgs::msg::PoseStamped::ConstSharedPtr pose_msg,
+                        const geometry_msgs::msg::TwistStamped::ConstSharedPtr twist_msg);
+  void odometry_callback(nav_msgs::msg::Odometry::ConstSharedPtr msg);
+  void ref_pose_callback(geometry_msgs::msg::PoseStamped::SharedPtr msg);
+  void ref_twist_callback(geometry_msgs::msg::TwistStamped::SharedPtr msg);
+  void ref_thrust_callback(as2_msgs::msg::Thrust::SharedPtr msg);
+  void ref_traj_callback(trajectory_msgs::msg::JointTrajectoryPoint::SharedPtr msg);
+  void ref_traj_batch_callback(trajectory_msgs::msg::JointTrajectory::SharedPtr msg);
+  void platform_info_callback(as2_msgs::msg::PlatformInfo::SharedPtr msg);
+
+  void setupStateSubscriptions(const rclcpp::SubscriptionOptions &options);
+  // subscription receiving its messages in a pool of message_pool_size of them
+  template <typename MessageT, typename CallbackT>
+  typename PooledSubscription<MessageT>::SharedPtr createPooledSubscription(
+      const std::string& topic, const rclcpp::QoS& qos, CallbackT&& callback,
+      const rclcpp::SubscriptionOptions& options);
+  // qos.<topic_class>.* applied on top of the as2 profile of the topic
+  rclcpp::QoS topicQoS(const std::string& topic_class, rclcpp::QoS qos) const;
+  // options flagging the topic bits in missed when the qos deadline is missed
+  rclcpp::SubscriptionOptions deadlineOptions(const rclcpp::SubscriptionOptions& options,
+                                              const rclcpp::QoS& qos,
+                                              std::atomic<uint8_t>& missed,
+                                              const uint8_t topics);
+  void storeState(const geometry_msgs::msg::PoseStamped::ConstSharedPtr& pose_msg,
+                  const geometry_msgs::msg::TwistStamped::ConstSharedPtr& twist_msg);
+  void storeSharedMemoryState();
+  void writeSharedMemoryCommand(const uint8_t mask,
+                                const geometry_msgs::msg::PoseStamped& pose,
+                                const geometry_msgs::msg::TwistStamped& twist,
+                                const as2_msgs::msg::Thrust& thrust);
+  void consumeInputs();
+  void interpolateState(const rclcpp::Time &stamp);
+
+  // previous samples are only kept so the interpolate policy can estimate the state at tick time
+  struct StateSnapshot {
+    geometry_msgs::msg::PoseStamped::ConstSharedPtr pose;
+    geometry_msgs::msg::TwistStamped::ConstSharedPtr twist;
+    geometry_msgs::msg::PoseStamped::ConstSharedPtr prev_pose;
+    geometry_msgs::msg::TwistStamped::ConstSharedPtr prev_twist;
+  };
 
-  void control_timer_callback();
-  void setControlModeSrvCall(const as2_msgs::srv::SetControlMode::Request::SharedPtr request,
-                             as2_msgs::srv::SetControlMode::Response::SharedPtr response);
-  bool listPlatformAvailableControlModes();
-
-  bool tryToBypassController(const uint8_t input_mode, uint8_t& output_mode);
-  bool findSuitableOutputControlModeForPlatformInputMode(uint8_t& output_mode,
-                                                         const uint8_t input_mode);
-  bool checkSuitabilityInputMode(const uint8_t input_mode, const uint8_t output_mode);
+  // last two samples of each input, only touched by the input thread
+  geometry_msgs::msg::PoseStamped::ConstSharedPtr last_pose_, prev_pose_;
+  geometry_msgs::msg::TwistStamped::ConstSharedPtr last_twist_, prev_twist_;
+  // topics renewed since the last state triggered tick of the latest and interpolate policies
+  uint8_t latest_state_topics_ = 0;
+
+  // state handed to the plugin on every tick when interpolating
+  bool interpolate_state_ = false;
+  geometry_msgs::msg::PoseStamped interpolated_pose_;
+  geometry_msgs::msg::TwistStamped interpolated_twist_;
+
+  // written by the input callbacks, read by the control loop. Null until the first message
+  TripleBuffer<StateSnapshot> state_buffer_;
+  TripleBuffer<geometry_msgs::msg::PoseStamped::ConstSharedPtr> ref_pose_buffer_;
+  TripleBuffer<geometry_msgs::msg::TwistStamped::ConstSharedPtr> ref_twist_buffer_;
+  TripleBuffer<as2_msgs::msg::Thrust::ConstSharedPtr> ref_thrust_buffer_;
+  TripleBuffer<trajectory_msgs::msg::JointTrajectoryPoint::ConstSharedPtr> ref_traj_buffer_;
+  TripleBuffer<trajectory_msgs::msg::JointTrajectory::ConstSharedPtr> ref_traj_batch_buffer_;
+
+  // trajectory batches merged by the control loop and the reference sampled from them
+  TrajectoryBuffer trajectory_buffer_;
+  trajectory_msgs::msg::JointTrajectoryPoint traj_reference_;
+  // the last trajectory reference was sampled from the buffer, not a single setpoint
+  bool traj_reference_sampled_ = false;
+  TripleBuffer<as2_msgs::msg::PlatformInfo::ConstSharedPtr> platform_info_buffer_;
+
+  // last command, for mode hand-offs. The tick computes on them when the messages are neither
+  // loaned nor handed over intra-process
+  geometry_msgs::msg::PoseStamped command_pose_;
+  geometry_msgs::msg::TwistStamped command_twist_;
+  as2_msgs::msg::Thrust command_thrust_;
+  // actuator command topics used by the current output mode
+  uint8_t publish_mask_ = POSE_COMMAND | TWIST_COMMAND | THRUST_COMMAND;
+  // commands are handed over as unique_ptr to co-located subscribers
+  bool use_intra_process_ = false;
+  // messages preallocated for each topic, 0 allocates them on the heap
+  uint32_t message_pool_size_ = 16;
+  // a command has been sent, the last one stays in the command messages above
+  bool command_sent_ = false;
+
+  // bypass forwarding: references new in this tick, and the optional keep alive period
+  bool ref_pose_fresh_ = false;
+  bool ref_twist_fresh_ = false;
+  bool ref_thrust_fresh_ = false;
+  std::atomic<bool> forward_on_reference_{false};
+  int64_t bypass_keep_alive_ns_ = 0;
+  int64_t last_forward_ns_ = 0;
+
+  // input deadlines, 0 disables them
+  enum class WatchdogAction { HOLD, HOVER, ZERO_THRUST };
+  int64_t state_timeout_ns_ = 0;
+  int64_t reference_timeout_ns_ = 0;
+  WatchdogAction watchdog_action_ = WatchdogAction::HOLD;
+  std::atomic<bool> watchdog_tripped_{false};
+  // input topics that missed their qos deadline since their last message, also trip the
+  // watchdog. References only count if they were used in the current mode
+  static constexpr uint8_t POSE_TOPIC = 0b00001;
+  static constexpr uint8_t TWIST_TOPIC = 0b00010;
+  static constexpr uint8_t THRUST_TOPIC = 0b00100;
+  static constexpr uint8_t TRAJECTORY_TOPIC = 0b01000;
+  static constexpr uint8_t TRAJECTORY_BATCH_TOPIC = 0b10000;
+  bool deadline_monitoring_ = false;
+  std::atomic<uint8_t> state_deadline_missed_{0};
+  std::atomic<uint8_t> reference_deadline_missed_{0};
+  uint8_t reference_topics_ = 0;
+  std::atomic<uint64_t> watchdog_trips_{0};
+  rclcpp::Publisher<diagnostic_msgs::msg::DiagnosticStatus>::SharedPtr watchdog_pub_;
+
+  // transport shm: state and commands exchanged with the platform driver through shared memory
+  std::unique_ptr<shm::Transport> shm_transport_;
+  shm::StateSample shm_state_sample_{};
+  shm::CommandSample shm_command_sample_{};
+  std::array<std::shared_ptr<geometry_msgs::msg::PoseStamped>, 2> shm_pose_;
+  std::array<std::shared_ptr<geometry_msgs::msg::TwistStamped>, 2> shm_twist_;
+  size_t shm_slot_ = 0;
+
+  // flight recorder: inputs consumed, commands sent and mode changes, dumped on request and
+  // when the watchdog trips. The dumps are written by the service thread
+  std::unique_ptr<recorder::FlightRecorder> flight_recorder_;
+  std::atomic<bool> flight_dump_requested_{false};
+  rclcpp::TimerBase::SharedPtr flight_recorder_timer_;
+  rclcpp::Service<std_srvs::srv::Trigger>::SharedPtr dump_flight_record_srv_;
+  void openFlightRecorder();
+  void recordMessages(const uint8_t type,
+                      const geometry_msgs::msg::PoseStamped* pose,
+                      const geometry_msgs::msg::TwistStamped* twist,
+                      const as2_msgs::msg::Thrust* thrust,
+                      const uint8_t mask = 0);
+  void recordTrajectory(const trajectory_msgs::msg::JointTrajectoryPoint& point);
+  void recordMode(const bool success);
+  bool dumpFlightRecord(std::string& path_or_error);
+  void flight_recorder_timer_callback();
+  void dumpFlightRecordSrvCall(const std_srvs::srv::Trigger::Request::SharedPtr request,
+                               std_srvs::srv::Trigger::Response::SharedPtr response);
+
+  void startControlTimer();
+  std::vector<std::unique_ptr<ComputeStage>> compute_stages_;
+  // last tick computed commands, cleared by mode changes until the next one does
+  std::atomic<bool> stages_active_{false};
+  void runComputeStage(ComputeStage& stage);
+  std::vector<std::unique_lock<std::mutex>> lockComputeStages();
+  // plugin computing the commands, this one unless another has been swapped in
+  ControllerBase& plugin() { return active_plugin_ ? *active_plugin_ : *this; };
+  // written under mode_mutex_, atomically so the parameter callback can load it without it
+  std::shared_ptr<ControllerBase> active_plugin_;
+  rclcpp::node_interfaces::OnSetParametersCallbackHandle::SharedPtr parameters_callback_handle_;
+  rcl_interfaces::msg::SetParametersResult parametersCallback(
+      const std::vector<rclcpp::Parameter>& parameters);
+  void updateControlDeadline();
+  void updateRateBounds(ControllerBase& next);
+  void governRate();
+  void setControlRate(const double freq);
+  void publishGovernorEvent(const std::string& message);
+  void diagnostics_timer_callback();
+  // deferred response, answered by finishModeNegotiation once the platform replies
+  void setControlModeSrvCall(const std::shared_ptr<rmw_request_id_t> request_header,
+                             const as2_msgs::srv::SetControlMode::Request::SharedPtr request);
+  void listPlatformAvailableControlModes();
+  void platform_discovery_timer_callback();
+  void fetchPlatformControlModes();
+  void setPlatformControlModes(const std::vector<uint8_t>& modes);
+  void negotiateOutputMode();
+  void applyNegotiatedMode();
+  void handOffMode(const ModeHandoff& handoff);
+  void finishModeNegotiation(const bool success);
+
+  void listCompatibleControlModesSrvCall(
+      const as2_msgs::srv::ListControlModes::Request::SharedPtr request,
+      as2_msgs::srv::ListControlModes::Response::SharedPtr response);
+
+  bool checkSuitabilityInputMode(const uint8_t input_mode) const;
+  void buildControlModeTable();
+  static uint8_t computePublishMask(const as2_msgs::msg::ControlMode& mode);
+  // inputs consumed and checks passed, a command has to be sent. Call with mode_mutex_ held
+  bool prepareTick();
+  bool checkWatchdog();
+  void forwardReferences();
+  void referenceEventTick();
+  void applyFailsafe();
+  void requestHover();
+  void publishWatchdogEvent(const uint8_t level, const std::string& message);
   void sendCommand();
-  bool setPlatformControlMode(const as2_msgs::msg::ControlMode& mode);
+  // fills the command messages through compute(pose, twist, thrust) and publishes them
+  template <typename ComputeT>
+  void publishCommand(ComputeT&& compute);
+  void setPlatformControlMode(const as2_msgs::msg::ControlMode& mode);
 
 };  //  ControllerBase
 
@@ -0,0 +1,101 @@
+/********************************************************************************************
+ *  \file       controller_base_t.hpp
+ *  \brief      Statically dispatched variant of ControllerBase for controller plugins
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef CONTROLLER_BASE_T_HPP
+#define CONTROLLER_BASE_T_HPP
+
+#include <type_traits>
+
+#include "controller_plugin_base/controller_base.hpp"
+
+namespace controller_plugin_base {
+
+/**
+ * CRTP base for plugins that want their tick path inlined. The plugin derives from
+ * ControllerBaseT<Plugin>, is declared final and implements the usual ControllerBase methods.
+ * It is still a ControllerBase, so it is exported and loaded through pluginlib as any other:
+ *
+ *   class Plugin final : public controller_plugin_base::ControllerBaseT<Plugin> { ... };
+ *   PLUGINLIB_EXPORT_CLASS(ns::Plugin, controller_plugin_base::ControllerBase)
+ *
+ * Every tick then costs one virtual call for the new inputs and one for the output, and the
+ * updateState / updateReference / computeOutput calls behind them are resolved at compile
+ * time, so they can be inlined into the plugin. Plugins
+ * overriding only some updateReference overloads need a `using ControllerBase::updateReference;`
+ * so the others stay visible.
+ */
+template <typename Derived>
+class ControllerBaseT : public ControllerBase {
+  protected:
+  void dispatchCompute(geometry_msgs::msg::PoseStamped& pose,
+                       geometry_msgs::msg::TwistStamped& twist,
+                       as2_msgs::msg::Thrust& thrust) final {
+    static_assert(std::is_final<Derived>::value,
+                  "ControllerBaseT plugins must be final so their calls are devirtualized");
+    static_cast<Derived&>(*this).computeOutput(pose, twist, thrust);
+  }
+
+  void dispatchInputs(const TickInputs& inputs) final {
+    static_assert(std::is_final<Derived>::value,
+                  "ControllerBaseT plugins must be final so their calls are devirtualized");
+    Derived& self = static_cast<Derived&>(*this);
+    if (inputs.pose) {
+      CONTROLLER_TRACEPOINT(update_state_entry, this, tracing::stampNs(inputs.pose->header.stamp));
+      self.updateState(*inputs.pose, *inputs.twist);
+      CONTROLLER_TRACEPOINT(update_state_exit, this, tracing::stampNs(inputs.pose->header.stamp));
+    }
+    if (inputs.ref_pose) {
+      traceReference(tracing::POSE, inputs.ref_pose->header.stamp,
+                     [&]() { self.updateReference(*inputs.ref_pose); });
+    }
+    if (inputs.ref_twist) {
+      traceReference(tracing::TWIST, inputs.ref_twist->header.stamp,
+                     [&]() { self.updateReference(*inputs.ref_twist); });
+    }
+    if (inputs.ref_thrust) {
+      traceReference(tracing::THRUST, inputs.ref_thrust->header.stamp,
+                     [&]() { self.updateReference(*inputs.ref_thrust); });
+    }
+    if (inputs.ref_traj) {
+      traceReference(tracing::TRAJECTORY, builtin_interfaces::msg::Time(),
+                     [&]() { self.updateReference(*inputs.ref_traj); });
+    }
+  }
+};
+
+}  // namespace controller_plugin_base
+
+#endif  // CONTROLLER_BASE_T_HPP
@@ -0,0 +1,147 @@
+/********************************************************************************************
+ *  \file       flight_recorder.hpp
+ *  \brief      Always-on recording of the controller inputs and outputs in a memory mapped
+ *              ring. The structures below are the layout of the recorder and dump files
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef FLIGHT_RECORDER_HPP
+#define FLIGHT_RECORDER_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace controller_plugin_base {
+namespace recorder {
+
+constexpr uint32_t MAGIC   = 0x46325341;  // "AS2F"
+// bump on any change of the structures below
+constexpr uint32_t VERSION = 1;
+
+enum RecordType : uint8_t {
+  STATE = 1,             // pose and twist consumed by the control loop
+  REFERENCE_POSE,
+  REFERENCE_TWIST,
+  REFERENCE_THRUST,
+  // stamp is the time from start. Positions in position and thrust (yaw), velocities in
+  // linear and accelerations in angular
+  REFERENCE_TRAJECTORY,
+  COMMAND,               // mask holds the published command topics
+  MODE,                  // input and output modes. mask 2 controlled, 1 bypassed, 0 rejected
+  FAILSAFE,              // watchdog tripped
+};
+
+struct Record {
+  int64_t time_ns;   // node clock when recorded
+  int64_t stamp_ns;  // header stamp of the recorded message
+  uint8_t type;
+  uint8_t mask;
+  uint8_t input_mode;
+  uint8_t output_mode;
+  double position[3];
+  double orientation[4];  // x, y, z, w
+  double linear[3];
+  double angular[3];
+  double thrust;
+};
+
+struct Slot {
+  // 2 * index + 2 once the record is complete, odd while being written
+  std::atomic<uint64_t> sequence;
+  Record record;
+};
+
+// followed by capacity slots, the record of index i lives in slot i % capacity
+struct Header {
+  uint32_t magic;
+  uint32_t version;
+  uint32_t record_size;
+  uint32_t capacity;
+  // number of records written so far
+  alignas(64) std::atomic<uint64_t> write_count;
+};
+
+/**
+ * Fixed size ring of records in a memory mapped file. Any thread can write, a record index is
+ * reserved with a single atomic increment and its slot is guarded by a sequence number, so
+ * writers never wait and readers discard the slots overwritten while copying them. The page
+ * cache keeps the file up to date even if the process dies, the previous file is kept as
+ * <file>.prev when opening.
+ */
+class FlightRecorder {
+  static_assert(std::is_trivially_copyable<Record>::value, "records must be POD");
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "lock free atomics are required");
+
+  public:
+  FlightRecorder() = default;
+  ~FlightRecorder();
+  FlightRecorder(const FlightRecorder&) = delete;
+  FlightRecorder& operator=(const FlightRecorder&) = delete;
+
+  // false, with the reason in error, when the file cannot be created or mapped
+  bool open(const std::string& path, const size_t capacity, std::string& error);
+
+  void write(const Record& record) {
+    const uint64_t index = header_->write_count.fetch_add(1, std::memory_order_relaxed);
+    Slot& slot           = slots_[index % capacity_];
+    slot.sequence.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&slot.record, &record, sizeof(Record));
+    slot.sequence.store(2 * index + 2, std::memory_order_release);
+  }
+
+  // schedules the write back of the mapping, does not wait for it
+  void flush();
+
+  // copies the complete records, oldest first, to a file with the recorder layout
+  bool dump(const std::string& path, std::string& error) const;
+
+  const std::string& path() const { return path_; }
+
+  private:
+  std::string path_;
+  void* addr_      = nullptr;
+  size_t size_     = 0;
+  size_t capacity_ = 0;
+  Header* header_  = nullptr;
+  Slot* slots_     = nullptr;
+};
+
+}  // namespace recorder
+}  // namespace controller_plugin_base
+
+#endif  // FLIGHT_RECORDER_HPP
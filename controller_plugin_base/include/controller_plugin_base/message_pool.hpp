@@ -0,0 +1,261 @@
+/********************************************************************************************
+ *  \file       message_pool.hpp
+ *  \brief      Lock-free pool of fixed size blocks and the allocator that hands the
+ *              messages exchanged with the middleware out of it
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+
+#ifndef MESSAGE_POOL_HPP
+#define MESSAGE_POOL_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include <rclcpp/allocator/allocator_deleter.hpp>
+#include <rclcpp/loaned_message.hpp>
+#include <rclcpp/publisher.hpp>
+#include <rclcpp/subscription.hpp>
+
+namespace controller_plugin_base {
+
+/**
+ * Fixed size blocks preallocated at construction. Any thread can take and return blocks
+ * without locks, the free list is a stack of block indices tagged against ABA. allocate()
+ * returns nullptr when the pool is exhausted.
+ */
+class MessagePool {
+  public:
+  MessagePool(const size_t block_size, const size_t min_size, const uint32_t count)
+      : block_size_(roundUp(block_size)),
+        min_size_(min_size),
+        count_(count),
+        storage_(new Block[count * (block_size_ / sizeof(Block))]),
+        next_(new std::atomic<uint32_t>[count]) {
+    for (uint32_t i = 0; i < count_; i++) {
+      next_[i].store(i + 1 < count_ ? i + 2 : 0, std::memory_order_relaxed);
+    }
+    head_.store(count_ > 0 ? 1 : 0, std::memory_order_release);
+  }
+
+  MessagePool(const MessagePool&)            = delete;
+  MessagePool& operator=(const MessagePool&) = delete;
+
+  // objects of this size range are served from the pool
+  bool fits(const size_t size) const { return size >= min_size_ && size <= block_size_; }
+
+  bool owns(const void* ptr) const {
+    const auto* byte = static_cast<const unsigned char*>(ptr);
+    const auto* base = reinterpret_cast<const unsigned char*>(storage_.get());
+    return byte >= base && byte < base + static_cast<size_t>(count_) * block_size_;
+  }
+
+  void* allocate() {
+    uint64_t head = head_.load(std::memory_order_acquire);
+    while (true) {
+      // the low half is the top block index plus one, 0 when empty
+      const uint32_t top = static_cast<uint32_t>(head);
+      if (top == 0) {
+        return nullptr;
+      }
+      const uint64_t next = tagged(head, next_[top - 1].load(std::memory_order_relaxed));
+      if (head_.compare_exchange_weak(head, next, std::memory_order_acq_rel,
+                                      std::memory_order_acquire)) {
+        return block(top - 1);
+      }
+    }
+  }
+
+  void deallocate(void* ptr) {
+    const auto* base = reinterpret_cast<unsigned char*>(storage_.get());
+    const uint32_t index =
+        static_cast<uint32_t>((static_cast<unsigned char*>(ptr) - base) / block_size_);
+    uint64_t head = head_.load(std::memory_order_relaxed);
+    uint64_t top;
+    do {
+      next_[index].store(static_cast<uint32_t>(head), std::memory_order_relaxed);
+      top = tagged(head, index + 1);
+    } while (!head_.compare_exchange_weak(head, top, std::memory_order_release,
+                                          std::memory_order_relaxed));
+  }
+
+  private:
+  using Block = std::max_align_t;
+
+  static size_t roundUp(const size_t size) {
+    return (size + sizeof(Block) - 1) / sizeof(Block) * sizeof(Block);
+  }
+
+  // the tag in the high half changes with every push and pop
+  static uint64_t tagged(const uint64_t head, const uint32_t top) {
+    return (((head >> 32) + 1) << 32) | top;
+  }
+
+  void* block(const uint32_t index) {
+    return reinterpret_cast<unsigned char*>(storage_.get()) + static_cast<size_t>(index) * block_size_;
+  }
+
+  const size_t block_size_;
+  const size_t min_size_;
+  const uint32_t count_;
+  std::unique_ptr<Block[]> storage_;
+  std::unique_ptr<std::atomic<uint32_t>[]> next_;
+  std::atomic<uint64_t> head_{0};
+};
+
+/**
+ * Standard allocator over a shared MessagePool, for the publishers and subscriptions of the
+ * controller. Single objects of the pool size range, i.e. the messages and the control blocks
+ * of the shared_ptrs holding them, come from the pool; anything else, or everything once the
+ * pool is exhausted or without a pool, from the heap.
+ */
+template <typename T>
+class MessagePoolAllocator {
+  public:
+  using value_type = T;
+
+  MessagePoolAllocator() = default;
+
+  explicit MessagePoolAllocator(std::shared_ptr<MessagePool> pool) : pool_(std::move(pool)) {}
+
+  template <typename U>
+  MessagePoolAllocator(const MessagePoolAllocator<U>& other) : pool_(other.pool()) {}
+
+  T* allocate(const size_t n) {
+    if (n == 1 && pool_ && pool_->fits(sizeof(T))) {
+      if (void* ptr = pool_->allocate()) {
+        return static_cast<T*>(ptr);
+      }
+    }
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  // the middleware does not always pass back the allocated count, blocks are told by address
+  void deallocate(T* ptr, const size_t) {
+    if (pool_ && pool_->owns(ptr)) {
+      pool_->deallocate(ptr);
+      return;
+    }
+    ::operator delete(ptr);
+  }
+
+  const std::shared_ptr<MessagePool>& pool() const { return pool_; }
+
+  template <typename U>
+  bool operator==(const MessagePoolAllocator<U>& other) const {
+    return pool_ == other.pool();
+  }
+
+  template <typename U>
+  bool operator!=(const MessagePoolAllocator<U>& other) const {
+    return pool_ != other.pool();
+  }
+
+  private:
+  std::shared_ptr<MessagePool> pool_;
+};
+
+// Pool for count messages of type MessageT, null when count is 0
+template <typename MessageT>
+std::shared_ptr<MessagePool> makeMessagePool(const uint32_t count) {
+  if (count == 0) {
+    return nullptr;
+  }
+  // room for the message together with the control block of std::allocate_shared
+  return std::make_shared<MessagePool>(sizeof(MessageT) + 64, sizeof(MessageT), count);
+}
+
+// message handed to the middleware as unique_ptr, returned to the pool when released
+template <typename MessageT>
+using PooledMessage = std::unique_ptr<
+    MessageT,
+    rclcpp::allocator::Deleter<MessagePoolAllocator<MessageT>, MessageT>>;
+
+template <typename MessageT>
+using PooledPublisher = rclcpp::Publisher<MessageT, MessagePoolAllocator<void>>;
+
+template <typename MessageT>
+using PooledSubscription = rclcpp::Subscription<MessageT, MessagePoolAllocator<void>>;
+
+template <typename MessageT>
+using PooledLoan = rclcpp::LoanedMessage<MessageT, MessagePoolAllocator<void>>;
+
+// Default constructed message out of the allocator, which has to outlive it
+template <typename MessageT>
+PooledMessage<MessageT> makePooledMessage(MessagePoolAllocator<MessageT>& allocator) {
+  using Traits = std::allocator_traits<MessagePoolAllocator<MessageT>>;
+  MessageT* ptr = Traits::allocate(allocator, 1);
+  Traits::construct(allocator, ptr);
+  return PooledMessage<MessageT>(ptr, typename PooledMessage<MessageT>::deleter_type(&allocator));
+}
+
+/**
+ * Preallocated messages filled in by the node itself, e.g. the halves of a split message, for
+ * a single writer thread. A message is reused once nobody else holds it, assigning into it
+ * keeps the capacity of its strings and sequences. acquire() only allocates when every message
+ * is still in use.
+ */
+template <typename MessageT>
+class MessageRing {
+  public:
+  explicit MessageRing(const uint32_t count = 0) : messages_(count) {
+    for (auto& message : messages_) {
+      message = std::make_shared<MessageT>();
+    }
+  }
+
+  std::shared_ptr<MessageT> acquire() {
+    for (size_t i = 0; i < messages_.size(); i++) {
+      auto& message = messages_[next_];
+      next_         = next_ + 1 < messages_.size() ? next_ + 1 : 0;
+      if (message.use_count() == 1) {
+        // the last reader released it
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return message;
+      }
+    }
+    return std::make_shared<MessageT>();
+  }
+
+  private:
+  std::vector<std::shared_ptr<MessageT>> messages_;
+  size_t next_ = 0;
+};
+
+};  // namespace controller_plugin_base
+
+#endif  // MESSAGE_POOL_HPP
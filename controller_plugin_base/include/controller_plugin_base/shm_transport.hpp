@@ -0,0 +1,181 @@
+/********************************************************************************************
+ *  \file       shm_transport.hpp
+ *  \brief      Shared memory state and command exchange with co-located platform
+ *              drivers. The structures below are the memory layout shared with them
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef SHM_TRANSPORT_HPP
+#define SHM_TRANSPORT_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+
+namespace controller_plugin_base {
+namespace shm {
+
+constexpr uint32_t MAGIC   = 0x43325341;  // "AS2C"
+// bump on any change of the structures below
+constexpr uint32_t VERSION = 1;
+constexpr size_t RING_SIZE = 64;
+constexpr size_t FRAME_ID_SIZE = 32;
+
+// same command bits as the controller publish mask
+constexpr uint8_t POSE    = 0b001;
+constexpr uint8_t TWIST   = 0b010;
+constexpr uint8_t THRUST  = 0b100;
+
+struct StateSample {
+  int64_t stamp_ns;
+  double position[3];
+  double orientation[4];  // x, y, z, w
+  double linear[3];
+  double angular[3];
+  char pose_frame_id[FRAME_ID_SIZE];
+  char twist_frame_id[FRAME_ID_SIZE];
+};
+
+struct CommandSample {
+  int64_t stamp_ns;
+  uint8_t mask;  // fields in use, see POSE, TWIST and THRUST
+  double position[3];
+  double orientation[4];  // x, y, z, w
+  double linear[3];
+  double angular[3];
+  double thrust;
+  char pose_frame_id[FRAME_ID_SIZE];
+  char twist_frame_id[FRAME_ID_SIZE];
+};
+
+/**
+ * Single writer ring of samples living in shared memory. Every slot is guarded by a sequence
+ * number (odd while being written), readers copy a slot and discard it if the sequence changed
+ * meanwhile. The writer never waits for the readers.
+ */
+template <typename T>
+struct Ring {
+  static_assert(std::is_trivially_copyable<T>::value, "shared memory samples must be POD");
+  static_assert(std::atomic<uint64_t>::is_always_lock_free, "lock free atomics are required");
+
+  struct Slot {
+    std::atomic<uint64_t> sequence;
+    T sample;
+  };
+
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint32_t sample_size;
+  uint32_t ring_size;
+  // number of samples written so far
+  alignas(64) std::atomic<uint64_t> write_count;
+  alignas(64) Slot slots[RING_SIZE];
+
+  void write(const T& sample) {
+    const uint64_t count = write_count.load(std::memory_order_relaxed);
+    Slot& slot           = slots[count % RING_SIZE];
+    slot.sequence.store(2 * count + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(&slot.sample, &sample, sizeof(T));
+    slot.sequence.store(2 * count + 2, std::memory_order_release);
+    write_count.store(count + 1, std::memory_order_release);
+  }
+
+  // copies the newest sample if it is newer than last_count, which is updated
+  bool readLatest(T& sample, uint64_t& last_count) const {
+    const uint64_t count = write_count.load(std::memory_order_acquire);
+    if (count == 0 || count == last_count) {
+      return false;
+    }
+    const Slot& slot        = slots[(count - 1) % RING_SIZE];
+    const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence != 2 * count) {
+      return false;  // overwritten by a newer sample, read again on the next call
+    }
+    std::memcpy(&sample, &slot.sample, sizeof(T));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+      return false;
+    }
+    last_count = count;
+    return true;
+  }
+};
+
+using StateRing   = Ring<StateSample>;
+using CommandRing = Ring<CommandSample>;
+
+/**
+ * Maps the state and command rings of a vehicle. Segments are named
+ * /as2<namespace with '/' replaced by '_'>_state and ..._command, both sides create them on
+ * open and the first one initializes the header.
+ */
+class Transport {
+  public:
+  Transport() = default;
+  ~Transport();
+  Transport(const Transport&) = delete;
+  Transport& operator=(const Transport&) = delete;
+
+  // false, with the reason in error, when a segment cannot be mapped or has another layout
+  bool open(const std::string& name_space, std::string& error);
+
+  bool readState(StateSample& sample) { return state_->readLatest(sample, last_state_count_); }
+  void writeCommand(const CommandSample& sample) { command_->write(sample); }
+
+  static std::string segmentName(const std::string& name_space, const std::string& channel);
+
+  private:
+  template <typename RingT>
+  RingT* map(const std::string& name, std::string& error);
+
+  StateRing* state_     = nullptr;
+  CommandRing* command_ = nullptr;
+  uint64_t last_state_count_ = 0;
+};
+
+// fixed size frame ids, always null terminated
+inline void copyFrameId(char (&dst)[FRAME_ID_SIZE], const std::string& src) {
+  const size_t n = std::min(src.size(), FRAME_ID_SIZE - 1);
+  std::memcpy(dst, src.data(), n);
+  dst[n] = '\0';
+}
+
+}  // namespace shm
+}  // namespace controller_plugin_base
+
+#endif  // SHM_TRANSPORT_HPP
@@ -0,0 +1,136 @@
+/********************************************************************************************
+ *  \file       snapshot_buffer.hpp
+ *  \brief      Lock-free single producer / single consumer buffers to share
+ *              messages between the input callbacks and the control loop
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef SNAPSHOT_BUFFER_HPP
+#define SNAPSHOT_BUFFER_HPP
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+namespace controller_plugin_base {
+
+/**
+ * Triple buffer: the writer never blocks the reader and the reader always gets the last
+ * complete value. One writer thread and one reader thread at a time.
+ */
+template <typename T>
+class TripleBuffer {
+  public:
+  TripleBuffer() = default;
+
+  explicit TripleBuffer(const T& initial_value) { buffers_.fill(initial_value); }
+
+  // Writer: buffer to fill, not visible to the reader until publish()
+  T& writeBuffer() { return buffers_[back_]; }
+
+  // Writer: make the write buffer the latest value
+  void publish() {
+    const uint8_t previous = state_.exchange(back_ | DIRTY_BIT, std::memory_order_acq_rel);
+    back_ = previous & INDEX_MASK;
+  }
+
+  // Writer: copy value and publish it
+  void write(const T& value) {
+    writeBuffer() = value;
+    publish();
+  }
+
+  // Reader: take the latest published value, returns false if nothing new was published
+  bool update() {
+    if (!(state_.load(std::memory_order_relaxed) & DIRTY_BIT)) {
+      return false;
+    }
+    const uint8_t previous = state_.exchange(front_, std::memory_order_acq_rel);
+    front_ = previous & INDEX_MASK;
+    return true;
+  }
+
+  // Reader: value taken by the last update(), stable until the next update()
+  const T& read() const { return buffers_[front_]; }
+
+  // Reader or writer: apply f to the three buffers, only safe before both sides start
+  template <typename F>
+  void forEach(F&& f) {
+    for (auto& buffer : buffers_) {
+      f(buffer);
+    }
+  }
+
+  private:
+  static constexpr uint8_t INDEX_MASK = 0b011;
+  static constexpr uint8_t DIRTY_BIT  = 0b100;
+
+  std::array<T, 3> buffers_;
+  uint8_t front_ = 0;                // owned by the reader
+  std::atomic<uint8_t> state_{1};    // middle buffer index and dirty bit
+  uint8_t back_ = 2;                 // owned by the writer
+};
+
+// result of a compute stage handed to the next one, see ControllerBase::addComputeStage
+template <typename T>
+using Mailbox = TripleBuffer<T>;
+
+/**
+ * Immutable parameter set, e.g. plugin gains, handed from the parameter callback to the
+ * control thread. The callbacks are serialized by the node, so there is one writer at a time;
+ * values are built and copied off the control thread, which takes the latest one with update()
+ * and reads it without locks nor allocations.
+ */
+template <typename T>
+class ParameterSnapshot {
+  public:
+  ParameterSnapshot() = default;
+
+  explicit ParameterSnapshot(const T& initial_value) : buffer_(initial_value) {}
+
+  // Writer: make value the latest parameter set
+  void publish(const T& value) { buffer_.write(value); }
+
+  // Reader: take the latest parameter set, returns false if nothing new was published
+  bool update() { return buffer_.update(); }
+
+  // Reader: parameter set taken by the last update(), stable until the next update()
+  const T& get() const { return buffer_.read(); }
+
+  private:
+  TripleBuffer<T> buffer_;
+};
+
+};  // namespace controller_plugin_base
+
+#endif  // SNAPSHOT_BUFFER_HPP
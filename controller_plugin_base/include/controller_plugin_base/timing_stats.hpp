@@ -0,0 +1,158 @@
+/********************************************************************************************
+ *  \file       timing_stats.hpp
+ *  \brief      Lock-free latency histograms for the control loop instrumentation
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef TIMING_STATS_HPP
+#define TIMING_STATS_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace controller_plugin_base {
+
+/**
+ * Nanosecond histogram with 4 buckets per power of two (<19% relative error). One thread
+ * records, any other thread summarizes the values recorded since its last summary.
+ */
+class LatencyHistogram {
+  public:
+  static constexpr size_t BUCKETS = 160;
+
+  struct Summary {
+    uint64_t count = 0;
+    double mean_us = 0.0;
+    double p50_us  = 0.0;
+    double p99_us  = 0.0;
+    double max_us  = 0.0;
+  };
+
+  // Reader side state, keeps the counts of the previous summary
+  struct Window {
+    std::array<uint64_t, BUCKETS> counts{};
+    uint64_t count  = 0;
+    int64_t sum_ns  = 0;
+  };
+
+  void record(int64_t value_ns) {
+    if (value_ns < 0) {
+      value_ns = -value_ns;
+    }
+    buckets_[bucketIndex(value_ns)].fetch_add(1, std::memory_order_relaxed);
+    sum_ns_.fetch_add(value_ns, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_release);
+
+    int64_t max = max_ns_.load(std::memory_order_relaxed);
+    while (value_ns > max &&
+           !max_ns_.compare_exchange_weak(max, value_ns, std::memory_order_relaxed)) {
+    }
+  }
+
+  // Values recorded since the previous call with the same window
+  Summary summarize(Window& window) {
+    Summary summary;
+    const uint64_t count = count_.load(std::memory_order_acquire);
+    const int64_t sum_ns = sum_ns_.load(std::memory_order_relaxed);
+    summary.count        = count - window.count;
+    summary.max_us       = max_ns_.exchange(0, std::memory_order_relaxed) / 1e3;
+
+    std::array<uint64_t, BUCKETS> delta;
+    uint64_t total = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+      const uint64_t bucket_count = buckets_[i].load(std::memory_order_relaxed);
+      delta[i]                    = bucket_count - window.counts[i];
+      window.counts[i]            = bucket_count;
+      total += delta[i];
+    }
+    if (summary.count > 0) {
+      summary.mean_us = (sum_ns - window.sum_ns) / 1e3 / summary.count;
+    }
+    summary.p50_us = percentile(delta, total, 0.50) / 1e3;
+    summary.p99_us = percentile(delta, total, 0.99) / 1e3;
+
+    window.count  = count;
+    window.sum_ns = sum_ns;
+    return summary;
+  }
+
+  static size_t bucketIndex(int64_t value_ns) {
+    const uint64_t value = static_cast<uint64_t>(value_ns);
+    if (value < 4) {
+      return value;
+    }
+    const int msb      = 63 - __builtin_clzll(value);
+    const size_t index = 4 + (msb - 2) * 4 + ((value >> (msb - 2)) & 0b11);
+    return index < BUCKETS ? index : BUCKETS - 1;
+  }
+
+  // Middle value of a bucket in nanoseconds
+  static double bucketValue(size_t index) {
+    if (index < 4) {
+      return index;
+    }
+    const int msb        = (index - 4) / 4 + 2;
+    const uint64_t sub   = (index - 4) % 4;
+    const uint64_t width = 1ull << (msb - 2);
+    return (4 + sub) * width + width / 2.0;
+  }
+
+  private:
+  static double percentile(const std::array<uint64_t, BUCKETS>& counts,
+                           uint64_t total,
+                           double quantile) {
+    if (total == 0) {
+      return 0.0;
+    }
+    const uint64_t target = static_cast<uint64_t>(quantile * (total - 1)) + 1;
+    uint64_t accumulated  = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+      accumulated += counts[i];
+      if (accumulated >= target) {
+        return bucketValue(i);
+      }
+    }
+    return bucketValue(BUCKETS - 1);
+  }
+
+  std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+  std::atomic<uint64_t> count_{0};
+  std::atomic<int64_t> sum_ns_{0};
+  std::atomic<int64_t> max_ns_{0};
+};
+
+};  // namespace controller_plugin_base
+
+#endif  // TIMING_STATS_HPP
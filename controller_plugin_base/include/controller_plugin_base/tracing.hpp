@@ -0,0 +1,77 @@
+/********************************************************************************************
+ *  \file       tracing.hpp
+ *  \brief      Static tracepoints of the controller pipeline. They compile out unless built
+ *              with the CONTROLLER_PLUGIN_BASE_TRACING CMake option
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef TRACING_HPP
+#define TRACING_HPP
+
+#include <cstdint>
+
+#include "builtin_interfaces/msg/time.hpp"
+
+#ifdef CONTROLLER_PLUGIN_BASE_TRACING
+#include "controller_plugin_base/tracing_provider.hpp"
+#define CONTROLLER_TRACEPOINT(event, ...) tracepoint(controller_plugin_base, event, __VA_ARGS__)
+#else
+// the arguments are not evaluated either
+#define CONTROLLER_TRACEPOINT(event, ...) ((void)0)
+#endif
+
+namespace controller_plugin_base {
+namespace tracing {
+
+// topic field of the reference and command events, same bits as the publish mask
+constexpr uint8_t POSE       = 0b0001;
+constexpr uint8_t TWIST      = 0b0010;
+constexpr uint8_t THRUST     = 0b0100;
+constexpr uint8_t TRAJECTORY = 0b1000;
+
+// stage field of the mode negotiation events
+enum NegotiationStage : uint8_t {
+  REQUESTED = 0,
+  LISTING_PLATFORM_MODES,
+  SETTING_PLATFORM_MODE,
+  FINISHED,
+};
+
+inline int64_t stampNs(const builtin_interfaces::msg::Time& stamp) {
+  return static_cast<int64_t>(stamp.sec) * 1000000000LL + stamp.nanosec;
+}
+
+}  // namespace tracing
+}  // namespace controller_plugin_base
+
+#endif  // TRACING_HPP
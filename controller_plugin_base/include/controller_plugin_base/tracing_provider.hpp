@@ -0,0 +1,141 @@
+/********************************************************************************************
+ *  \file       tracing_provider.hpp
+ *  \brief      LTTng tracepoint provider of the controller pipeline. Only included when
+ *              built with CONTROLLER_PLUGIN_BASE_TRACING, use tracing.hpp instead
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#undef TRACEPOINT_PROVIDER
+#define TRACEPOINT_PROVIDER controller_plugin_base
+
+#undef TRACEPOINT_INCLUDE
+#define TRACEPOINT_INCLUDE "controller_plugin_base/tracing_provider.hpp"
+
+#if !defined(TRACING_PROVIDER_HPP) || defined(TRACEPOINT_HEADER_MULTI_READ)
+#define TRACING_PROVIDER_HPP
+
+#include <lttng/tracepoint.h>
+#include <stdint.h>
+
+// stamps are the header stamps of the messages, in ns, so the events can be matched with the
+// traces of the estimator and the platform driver
+
+TRACEPOINT_EVENT(
+  controller_plugin_base,
+  state_callback,
+  TP_ARGS(const void *, controller_arg, int64_t, pose_stamp_arg, int64_t, twist_stamp_arg),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, controller, controller_arg)
+    ctf_integer(int64_t, pose_stamp, pose_stamp_arg)
+    ctf_integer(int64_t, twist_stamp, twist_stamp_arg)
+  )
+)
+
+// updateState entry and exit, computeOutput start and end
+TRACEPOINT_EVENT_CLASS(
+  controller_plugin_base,
+  state_class,
+  TP_ARGS(const void *, controller_arg, int64_t, state_stamp_arg),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, controller, controller_arg)
+    ctf_integer(int64_t, state_stamp, state_stamp_arg)
+  )
+)
+TRACEPOINT_EVENT_INSTANCE(controller_plugin_base, state_class, update_state_entry,
+  TP_ARGS(const void *, controller_arg, int64_t, state_stamp_arg))
+TRACEPOINT_EVENT_INSTANCE(controller_plugin_base, state_class, update_state_exit,
+  TP_ARGS(const void *, controller_arg, int64_t, state_stamp_arg))
+TRACEPOINT_EVENT_INSTANCE(controller_plugin_base, state_class, compute_output_start,
+  TP_ARGS(const void *, controller_arg, int64_t, state_stamp_arg))
+TRACEPOINT_EVENT_INSTANCE(controller_plugin_base, state_class, compute_output_end,
+  TP_ARGS(const void *, controller_arg, int64_t, state_stamp_arg))
+
+// updateReference entry and exit, topic is one of tracing::POSE, TWIST, THRUST or TRAJECTORY
+TRACEPOINT_EVENT_CLASS(
+  controller_plugin_base,
+  reference_class,
+  TP_ARGS(const void *, controller_arg, uint8_t, topic_arg, int64_t, stamp_arg),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, controller, controller_arg)
+    ctf_integer(uint8_t, topic, topic_arg)
+    ctf_integer(int64_t, stamp, stamp_arg)
+  )
+)
+TRACEPOINT_EVENT_INSTANCE(controller_plugin_base, reference_class, update_reference_entry,
+  TP_ARGS(const void *, controller_arg, uint8_t, topic_arg, int64_t, stamp_arg))
+TRACEPOINT_EVENT_INSTANCE(controller_plugin_base, reference_class, update_reference_exit,
+  TP_ARGS(const void *, controller_arg, uint8_t, topic_arg, int64_t, stamp_arg))
+
+TRACEPOINT_EVENT(
+  controller_plugin_base,
+  control_tick_start,
+  TP_ARGS(const void *, controller_arg, int64_t, now_arg),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, controller, controller_arg)
+    ctf_integer(int64_t, now, now_arg)
+  )
+)
+
+// one per command topic published, state_stamp is the state the command was computed from
+// (0 when bypassing)
+TRACEPOINT_EVENT(
+  controller_plugin_base,
+  command_publish,
+  TP_ARGS(const void *, controller_arg, uint8_t, topic_arg, int64_t, stamp_arg,
+          int64_t, state_stamp_arg),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, controller, controller_arg)
+    ctf_integer(uint8_t, topic, topic_arg)
+    ctf_integer(int64_t, stamp, stamp_arg)
+    ctf_integer(int64_t, state_stamp, state_stamp_arg)
+  )
+)
+
+TRACEPOINT_EVENT(
+  controller_plugin_base,
+  mode_negotiation,
+  TP_ARGS(const void *, controller_arg, uint64_t, negotiation_arg, uint8_t, stage_arg,
+          uint8_t, input_mode_arg, uint8_t, output_mode_arg, uint8_t, success_arg),
+  TP_FIELDS(
+    ctf_integer_hex(const void *, controller, controller_arg)
+    ctf_integer(uint64_t, negotiation, negotiation_arg)
+    ctf_integer(uint8_t, stage, stage_arg)
+    ctf_integer(uint8_t, input_mode, input_mode_arg)
+    ctf_integer(uint8_t, output_mode, output_mode_arg)
+    ctf_integer(uint8_t, success, success_arg)
+  )
+)
+
+#endif  // TRACING_PROVIDER_HPP
+
+#include <lttng/tracepoint-event.h>
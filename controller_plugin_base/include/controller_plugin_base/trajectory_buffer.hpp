@@ -0,0 +1,163 @@
+/********************************************************************************************
+ *  \file       trajectory_buffer.hpp
+ *  \brief      Time indexed buffer of trajectory points evaluated at the control tick
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef TRAJECTORY_BUFFER_HPP
+#define TRAJECTORY_BUFFER_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "trajectory_msgs/msg/joint_trajectory.hpp"
+#include "trajectory_msgs/msg/joint_trajectory_point.hpp"
+
+namespace controller_plugin_base {
+
+/**
+ * Upcoming trajectory points with absolute time, evaluated on demand with cubic Hermite
+ * interpolation between the surrounding points. Fixed capacity, so merging and evaluating
+ * never allocate. Used from a single thread.
+ */
+class TrajectoryBuffer {
+  public:
+  static constexpr size_t CAPACITY = 256;
+  static constexpr size_t MAX_DIMENSIONS = 4;  // x, y, z, yaw
+
+  struct Point {
+    int64_t time_ns;
+    size_t dimensions;
+    std::array<double, MAX_DIMENSIONS> position;
+    std::array<double, MAX_DIMENSIONS> velocity;
+  };
+
+  bool empty() const { return size_ == 0; }
+  size_t size() const { return size_; }
+  void clear() { size_ = 0; }
+
+  // points of a trajectory starting at start_ns replace the buffered ones from its first point
+  // on. Points that do not fit are dropped from the end
+  void merge(const trajectory_msgs::msg::JointTrajectory& trajectory, const int64_t start_ns) {
+    if (trajectory.points.empty()) return;
+    const int64_t first_ns = start_ns + toNs(trajectory.points.front().time_from_start);
+    while (size_ > 0 && at(size_ - 1).time_ns >= first_ns) size_--;
+
+    int64_t last_ns = size_ > 0 ? at(size_ - 1).time_ns : INT64_MIN;
+    for (const auto& msg_point : trajectory.points) {
+      const int64_t time_ns = start_ns + toNs(msg_point.time_from_start);
+      if (time_ns <= last_ns) continue;  // only increasing times
+      if (size_ == CAPACITY) break;
+      Point& point     = at(size_++);
+      point.time_ns    = time_ns;
+      point.dimensions = std::min(msg_point.positions.size(), MAX_DIMENSIONS);
+      for (size_t i = 0; i < point.dimensions; i++) {
+        point.position[i] = msg_point.positions[i];
+        point.velocity[i] = i < msg_point.velocities.size() ? msg_point.velocities[i] : 0.0;
+      }
+      last_ns = time_ns;
+    }
+  }
+
+  // reference at time_ns written into point, whose vectors keep their capacity. Before the
+  // first point it is held at the first one. Past the last one, the last point is returned
+  // once with zero velocity and the trajectory expires, so it stops overriding the references
+  // that come after it. Points no longer needed are dropped
+  bool evaluate(const int64_t time_ns, trajectory_msgs::msg::JointTrajectoryPoint& point) {
+    if (size_ == 0) return false;
+    while (size_ > 1 && at(1).time_ns <= time_ns) pop();
+
+    const Point& p0 = at(0);
+    if (size_ == 1 || time_ns < p0.time_ns) {
+      const bool holding_last = size_ == 1 && time_ns >= p0.time_ns;
+      const size_t n          = p0.dimensions;
+      point.positions.resize(n);
+      point.velocities.resize(n);
+      point.accelerations.resize(n);
+      for (size_t i = 0; i < n; i++) {
+        point.positions[i]     = p0.position[i];
+        point.velocities[i]    = holding_last ? 0.0 : p0.velocity[i];
+        point.accelerations[i] = 0.0;
+      }
+      if (holding_last) pop();
+      return true;
+    }
+
+    // only the dimensions both points have, none is left from a previous evaluation
+    const Point& p1 = at(1);
+    const size_t n  = std::min(p0.dimensions, p1.dimensions);
+    point.positions.resize(n);
+    point.velocities.resize(n);
+    point.accelerations.resize(n);
+    const double h  = (p1.time_ns - p0.time_ns) * 1e-9;
+    const double s  = (time_ns - p0.time_ns) * 1e-9 / h;
+    // cubic Hermite basis and its derivatives with respect to time
+    const double s2 = s * s, s3 = s2 * s;
+    const double h00 = 2 * s3 - 3 * s2 + 1, h10 = s3 - 2 * s2 + s;
+    const double h01 = -2 * s3 + 3 * s2, h11 = s3 - s2;
+    const double d00 = (6 * s2 - 6 * s) / h, d10 = 3 * s2 - 4 * s + 1;
+    const double d01 = (-6 * s2 + 6 * s) / h, d11 = 3 * s2 - 2 * s;
+    const double a00 = (12 * s - 6) / (h * h), a10 = (6 * s - 4) / h;
+    const double a01 = (-12 * s + 6) / (h * h), a11 = (6 * s - 2) / h;
+    for (size_t i = 0; i < n; i++) {
+      const double x0 = p0.position[i], x1 = p1.position[i];
+      const double m0 = p0.velocity[i] * h, m1 = p1.velocity[i] * h;
+      point.positions[i]     = h00 * x0 + h10 * m0 + h01 * x1 + h11 * m1;
+      point.velocities[i]    = d00 * x0 + d10 * m0 / h + d01 * x1 + d11 * m1 / h;
+      point.accelerations[i] = a00 * x0 + a10 * m0 / h + a01 * x1 + a11 * m1 / h;
+    }
+    return true;
+  }
+
+  private:
+  static int64_t toNs(const builtin_interfaces::msg::Duration& duration) {
+    return static_cast<int64_t>(duration.sec) * 1000000000LL + duration.nanosec;
+  }
+
+  Point& at(const size_t i) { return points_[(head_ + i) % CAPACITY]; }
+  const Point& at(const size_t i) const { return points_[(head_ + i) % CAPACITY]; }
+  void pop() {
+    head_ = (head_ + 1) % CAPACITY;
+    size_--;
+  }
+
+  std::array<Point, CAPACITY> points_{};
+  size_t head_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace controller_plugin_base
+
+#endif  // TRAJECTORY_BUFFER_HPP
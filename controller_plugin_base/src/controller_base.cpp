@@ -40,35 +40,95 @@
 
 #include <as2_core/control_mode_utils/control_mode_utils.hpp>
 #include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
 #include <rclcpp/clock.hpp>
 #include <rclcpp/logging.hpp>
 #include <rclcpp/rate.hpp>
+#include <typeinfo>
 
 namespace controller_plugin_base
 {
 
-  static inline bool checkMatchWithMask(const uint8_t mode1, const uint8_t mode2,
-                                        const uint8_t mask)
+  static inline bool isControllableMode(const uint8_t mode)
   {
-    return (mode1 & mask) == (mode2 & mask);
+    return (mode & MATCH_MODE) != UNSET_MODE_MASK && (mode & MATCH_MODE) != HOVER_MODE_MASK;
   }
 
-  static uint8_t findBestMatchWithMask(const uint8_t mode, const std::vector<uint8_t> &mode_list,
-                                       const uint8_t mask)
+  // fraction of the way from the sample at t0 to the one at t1. Extrapolation is limited to
+  // one sample interval past the newest sample
+  static inline double interpolationFactor(const rclcpp::Time &t0, const rclcpp::Time &t1,
+                                           const rclcpp::Time &stamp)
   {
-    uint8_t best_match = 0;
-    for (const auto &candidate : mode_list)
+    if (t0.get_clock_type() != t1.get_clock_type() || t1.get_clock_type() != stamp.get_clock_type())
+      return 1.0;
+    const double dt = (t1 - t0).seconds();
+    if (dt <= 0.0)
+      return 1.0;
+    return std::clamp((stamp - t0).seconds() / dt, 0.0, 2.0);
+  }
+
+  static void slerp(const geometry_msgs::msg::Quaternion &q0, const geometry_msgs::msg::Quaternion &q1,
+                    const double t, geometry_msgs::msg::Quaternion &out)
+  {
+    double sign = 1.0;
+    double dot = q0.x * q1.x + q0.y * q1.y + q0.z * q1.z + q0.w * q1.w;
+    if (dot < 0.0)
     {
-      if (checkMatchWithMask(mode, candidate, mask))
-      {
-        best_match = candidate;
-        if (candidate == mode)
-        {
-          return candidate;
-        }
-      }
+      sign = -1.0;
+      dot = -dot;
+    }
+
+    double s0 = 1.0 - t;
+    double s1 = t;
+    if (dot < 0.9995)
+    {
+      const double theta = std::acos(dot);
+      const double sin_theta = std::sin(theta);
+      s0 = std::sin((1.0 - t) * theta) / sin_theta;
+      s1 = std::sin(t * theta) / sin_theta;
+    }
+    s1 *= sign;
+
+    out.x = s0 * q0.x + s1 * q1.x;
+    out.y = s0 * q0.y + s1 * q1.y;
+    out.z = s0 * q0.z + s1 * q1.z;
+    out.w = s0 * q0.w + s1 * q1.w;
+    const double norm = std::sqrt(out.x * out.x + out.y * out.y + out.z * out.z + out.w * out.w);
+    if (norm > 0.0)
+    {
+      out.x /= norm;
+      out.y /= norm;
+      out.z /= norm;
+      out.w /= norm;
     }
-    return best_match;
+  }
+
+  static inline void lerp(const geometry_msgs::msg::Vector3 &a, const geometry_msgs::msg::Vector3 &b,
+                          const double t, geometry_msgs::msg::Vector3 &out)
+  {
+    out.x = a.x + (b.x - a.x) * t;
+    out.y = a.y + (b.y - a.y) * t;
+    out.z = a.z + (b.z - a.z) * t;
+  }
+
+  template <typename MessageT, typename CallbackT>
+  typename PooledSubscription<MessageT>::SharedPtr ControllerBase::createPooledSubscription(
+      const std::string &topic, const rclcpp::QoS &qos, CallbackT &&callback,
+      const rclcpp::SubscriptionOptions &options)
+  {
+    // the messages are taken by the memory strategy, the buffers of the middleware and the
+    // nested sequences keep using the heap
+    using MemoryStrategy = rclcpp::message_memory_strategy::MessageMemoryStrategy<
+        MessageT, MessagePoolAllocator<void>>;
+    auto allocator = std::make_shared<MessagePoolAllocator<void>>(
+        makeMessagePool<MessageT>(message_pool_size_));
+    rclcpp::SubscriptionOptionsWithAllocator<MessagePoolAllocator<void>> pooled_options(options);
+    pooled_options.allocator = allocator;
+    return node_ptr_->create_subscription<MessageT>(topic, qos, std::forward<CallbackT>(callback),
+                                                    pooled_options,
+                                                    std::make_shared<MemoryStrategy>(allocator));
   }
 
   void ControllerBase::initialize(as2::Node *node_ptr)
@@ -76,356 +136,2111 @@ namespace controller_plugin_base
     node_ptr_ = node_ptr;
 
     node_ptr_->get_parameter("use_bypass", use_bypass_);
+    use_intra_process_ = node_ptr_->get_node_options().use_intra_process_comms();
+    int message_pool_size = 16;
+    node_ptr_->get_parameter("message_pool_size", message_pool_size);
+    message_pool_size_ = static_cast<uint32_t>(std::max(message_pool_size, 0));
 
-    pose_sub_ = std::make_shared<message_filters::Subscriber<geometry_msgs::msg::PoseStamped>>(node_ptr_, as2_names::topics::self_localization::pose, as2_names::topics::self_localization::qos.get_rmw_qos_profile());
-    twist_sub_ = std::make_shared<message_filters::Subscriber<geometry_msgs::msg::TwistStamped>>(node_ptr_, as2_names::topics::self_localization::twist, as2_names::topics::self_localization::qos.get_rmw_qos_profile());
-    synchronizer_ = std::make_shared<message_filters::Synchronizer<approximate_policy>>(approximate_policy(5), *(pose_sub_.get()), *(twist_sub_.get()));
-    synchronizer_->registerCallback(&ControllerBase::state_callback, this);
-
-    ref_pose_sub_ = node_ptr_->create_subscription<geometry_msgs::msg::PoseStamped>(
-        as2_names::topics::motion_reference::pose, as2_names::topics::motion_reference::qos,
-        std::bind(&ControllerBase::ref_pose_callback, this, std::placeholders::_1));
-    ref_twist_sub_ = node_ptr_->create_subscription<geometry_msgs::msg::TwistStamped>(
-        as2_names::topics::motion_reference::twist, as2_names::topics::motion_reference::qos,
-        std::bind(&ControllerBase::ref_twist_callback, this, std::placeholders::_1));
-    ref_traj_sub_ = node_ptr_->create_subscription<trajectory_msgs::msg::JointTrajectoryPoint>(
-        as2_names::topics::motion_reference::trajectory, as2_names::topics::motion_reference::qos,
-        std::bind(&ControllerBase::ref_traj_callback, this, std::placeholders::_1));
-    platform_info_sub_ = node_ptr_->create_subscription<as2_msgs::msg::PlatformInfo>(
+    // separate callback groups so the control loop can be served by its own executor thread
+    control_callback_group_ =
+        node_ptr_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    input_callback_group_ =
+        node_ptr_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    service_callback_group_ =
+        node_ptr_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+
+    rclcpp::SubscriptionOptions input_options;
+    input_options.callback_group = input_callback_group_;
+
+    std::string transport = "ros";
+    node_ptr_->get_parameter("transport", transport);
+    if (transport == "shm")
+    {
+      shm_transport_ = std::make_unique<shm::Transport>();
+      std::string error;
+      if (shm_transport_->open(node_ptr_->get_namespace(), error))
+      {
+        for (size_t i = 0; i < shm_pose_.size(); i++)
+        {
+          shm_pose_[i] = std::make_shared<geometry_msgs::msg::PoseStamped>();
+          shm_twist_[i] = std::make_shared<geometry_msgs::msg::TwistStamped>();
+        }
+        RCLCPP_INFO(node_ptr_->get_logger(), "State and commands through shared memory %s",
+                    shm::Transport::segmentName(node_ptr_->get_namespace(), "*").c_str());
+      }
+      else
+      {
+        RCLCPP_WARN(node_ptr_->get_logger(), "Shared memory transport not available, using topics: %s",
+                    error.c_str());
+        shm_transport_.reset();
+      }
+    }
+    else if (transport != "ros")
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "Unknown transport '%s', using ros", transport.c_str());
+    }
+
+    if (!shm_transport_)
+      setupStateSubscriptions(input_options);
+
+    const rclcpp::QoS reference_qos = topicQoS("reference", as2_names::topics::motion_reference::qos);
+    ref_pose_sub_ = createPooledSubscription<geometry_msgs::msg::PoseStamped>(
+        as2_names::topics::motion_reference::pose, reference_qos,
+        std::bind(&ControllerBase::ref_pose_callback, this, std::placeholders::_1),
+        deadlineOptions(input_options, reference_qos, reference_deadline_missed_, POSE_TOPIC));
+    ref_twist_sub_ = createPooledSubscription<geometry_msgs::msg::TwistStamped>(
+        as2_names::topics::motion_reference::twist, reference_qos,
+        std::bind(&ControllerBase::ref_twist_callback, this, std::placeholders::_1),
+        deadlineOptions(input_options, reference_qos, reference_deadline_missed_, TWIST_TOPIC));
+    // attitude references come as the orientation of the pose reference
+    ref_thrust_sub_ = createPooledSubscription<as2_msgs::msg::Thrust>(
+        "motion_reference/thrust", reference_qos,
+        std::bind(&ControllerBase::ref_thrust_callback, this, std::placeholders::_1),
+        deadlineOptions(input_options, reference_qos, reference_deadline_missed_, THRUST_TOPIC));
+    ref_traj_sub_ = createPooledSubscription<trajectory_msgs::msg::JointTrajectoryPoint>(
+        as2_names::topics::motion_reference::trajectory, reference_qos,
+        std::bind(&ControllerBase::ref_traj_callback, this, std::placeholders::_1),
+        deadlineOptions(input_options, reference_qos, reference_deadline_missed_, TRAJECTORY_TOPIC));
+    // batches of upcoming points, evaluated at every tick
+    std::string trajectory_batch_topic = "motion_reference/trajectory_batch";
+    node_ptr_->get_parameter("trajectory_batch_topic", trajectory_batch_topic);
+    ref_traj_batch_sub_ = createPooledSubscription<trajectory_msgs::msg::JointTrajectory>(
+        trajectory_batch_topic, reference_qos,
+        std::bind(&ControllerBase::ref_traj_batch_callback, this, std::placeholders::_1),
+        deadlineOptions(input_options, reference_qos, reference_deadline_missed_,
+                        TRAJECTORY_BATCH_TOPIC));
+    traj_reference_.positions.reserve(TrajectoryBuffer::MAX_DIMENSIONS);
+    traj_reference_.velocities.reserve(TrajectoryBuffer::MAX_DIMENSIONS);
+    traj_reference_.accelerations.reserve(TrajectoryBuffer::MAX_DIMENSIONS);
+    platform_info_sub_ = createPooledSubscription<as2_msgs::msg::PlatformInfo>(
         as2_names::topics::platform::info, as2_names::topics::platform::qos,
-        std::bind(&ControllerBase::platform_info_callback, this, std::placeholders::_1));
+        std::bind(&ControllerBase::platform_info_callback, this, std::placeholders::_1), input_options);
 
-    set_control_mode_client_ =
-        std::make_shared<as2::SynchronousServiceClient<as2_msgs::srv::SetControlMode>>(
-            as2_names::services::platform::set_platform_control_mode);
+    // asynchronous clients, their responses are served by the service callback group
+    set_control_mode_client_ = node_ptr_->create_client<as2_msgs::srv::SetControlMode>(
+        as2_names::services::platform::set_platform_control_mode, rmw_qos_profile_services_default,
+        service_callback_group_);
 
-    list_control_modes_client_ =
-        std::make_shared<as2::SynchronousServiceClient<as2_msgs::srv::ListControlModes>>(
-            as2_names::services::platform::list_control_modes);
+    list_control_modes_client_ = node_ptr_->create_client<as2_msgs::srv::ListControlModes>(
+        as2_names::services::platform::list_control_modes, rmw_qos_profile_services_default,
+        service_callback_group_);
 
+    node_ptr_->get_parameter("mode_negotiation_timeout", mode_negotiation_timeout_);
+
+    // intra-process commands are handed over as unique_ptr, a pool per topic keeps them off the
+    // heap. Messages sent through the middleware are serialized from the preallocated ones
+    if (use_intra_process_ && message_pool_size_ > 0)
+    {
+      const uint32_t count = message_pool_size_;
+      pose_allocator_ = MessagePoolAllocator<geometry_msgs::msg::PoseStamped>(
+          makeMessagePool<geometry_msgs::msg::PoseStamped>(count));
+      twist_allocator_ = MessagePoolAllocator<geometry_msgs::msg::TwistStamped>(
+          makeMessagePool<geometry_msgs::msg::TwistStamped>(count));
+      thrust_allocator_ = MessagePoolAllocator<as2_msgs::msg::Thrust>(
+          makeMessagePool<as2_msgs::msg::Thrust>(count));
+    }
+    const rclcpp::QoS command_qos = topicQoS("command", as2_names::topics::actuator_command::qos);
+    rclcpp::PublisherOptionsWithAllocator<MessagePoolAllocator<void>> command_options;
+    command_options.allocator = std::make_shared<MessagePoolAllocator<void>>(pose_allocator_);
     pose_pub_ = node_ptr_->create_publisher<geometry_msgs::msg::PoseStamped>(
-        as2_names::topics::actuator_command::pose, as2_names::topics::actuator_command::qos);
+        as2_names::topics::actuator_command::pose, command_qos, command_options);
+    command_options.allocator = std::make_shared<MessagePoolAllocator<void>>(twist_allocator_);
     twist_pub_ = node_ptr_->create_publisher<geometry_msgs::msg::TwistStamped>(
-        as2_names::topics::actuator_command::twist, as2_names::topics::actuator_command::qos);
+        as2_names::topics::actuator_command::twist, command_qos, command_options);
+    command_options.allocator = std::make_shared<MessagePoolAllocator<void>>(thrust_allocator_);
     thrust_pub_ = node_ptr_->create_publisher<as2_msgs::msg::Thrust>(
-        as2_names::topics::actuator_command::thrust, as2_names::topics::actuator_command::qos);
+        as2_names::topics::actuator_command::thrust, command_qos, command_options);
+
+    node_ptr_->get_parameter("publish_cmd_freq", cmd_freq_);
+    std::string control_loop_trigger = "timer";
+    node_ptr_->get_parameter("control_loop_trigger", control_loop_trigger);
+    if (cmd_freq_ <= 0.0)
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "Invalid publish_cmd_freq %f, using 100.0 Hz", cmd_freq_);
+      cmd_freq_ = 100.0;
+    }
+    control_period_ = rclcpp::Duration::from_seconds(1.0 / cmd_freq_);
+    control_freq_ = cmd_freq_;
+
+    if (control_loop_trigger == "state" && shm_transport_)
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "The shared memory state is polled, using timer trigger");
+      control_loop_trigger = "timer";
+    }
+    if (control_loop_trigger == "state")
+    {
+      // the control loop runs on every synchronized state message
+      control_on_state_ = true;
+    }
+    else if (control_loop_trigger == "external")
+    {
+      // ticked by the host, e.g. through controlTickBatch
+    }
+    else
+    {
+      if (control_loop_trigger != "timer")
+      {
+        RCLCPP_WARN(node_ptr_->get_logger(), "Unknown control_loop_trigger [%s], using timer",
+                    control_loop_trigger.c_str());
+      }
+      // controllers sharing a process start their loops at different phases of the period, so
+      // their ticks do not all land on the executor at the same instant
+      double control_phase = 0.0;
+      node_ptr_->get_parameter("control_phase", control_phase);
+      control_phase = std::clamp(control_phase, 0.0, 1.0);
+      if (control_phase > 0.0)
+      {
+        control_start_timer_ = rclcpp::create_timer(
+            node_ptr_, node_ptr_->get_clock(),
+            rclcpp::Duration::from_seconds(control_phase * control_period_.seconds()),
+            std::bind(&ControllerBase::startControlTimer, this), control_callback_group_);
+      }
+      else
+        startControlTimer();
+      RCLCPP_INFO(node_ptr_->get_logger(), "Control loop phase %.2f of the period", control_phase);
+    }
+    RCLCPP_INFO(node_ptr_->get_logger(), "Control loop at %.1f Hz triggered by %s", cmd_freq_,
+                control_on_state_ ? "state" : (control_timer_ || control_start_timer_) ? "timer" : "external");
+
+    node_ptr_->get_parameter("rate_governor.enabled", governor_.enabled);
+    node_ptr_->get_parameter("rate_governor.high_load", governor_.high_load);
+    node_ptr_->get_parameter("rate_governor.low_load", governor_.low_load);
+    node_ptr_->get_parameter("rate_governor.step", governor_.step);
+    governor_.step = std::clamp(governor_.step, 0.1, 0.95);
+    if (governor_.enabled && !control_timer_ && !control_start_timer_)
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "The rate governor needs the timer trigger, disabled");
+      governor_.enabled = false;
+    }
+
+    double state_timeout = 0.5, reference_timeout = 0.0;
+    std::string watchdog_action = "hold";
+    node_ptr_->get_parameter("watchdog.state_timeout", state_timeout);
+    node_ptr_->get_parameter("watchdog.reference_timeout", reference_timeout);
+    node_ptr_->get_parameter("watchdog.action", watchdog_action);
+    state_timeout_ns_ = static_cast<int64_t>(std::max(state_timeout, 0.0) * 1e9);
+    reference_timeout_ns_ = static_cast<int64_t>(std::max(reference_timeout, 0.0) * 1e9);
+    if (watchdog_action == "hover")
+      watchdog_action_ = WatchdogAction::HOVER;
+    else if (watchdog_action == "zero_thrust")
+      watchdog_action_ = WatchdogAction::ZERO_THRUST;
+    else if (watchdog_action != "hold")
+      RCLCPP_WARN(node_ptr_->get_logger(), "Unknown watchdog.action '%s', using hold",
+                  watchdog_action.c_str());
+    watchdog_pub_ = node_ptr_->create_publisher<diagnostic_msgs::msg::DiagnosticStatus>(
+        "controller/watchdog_events", rclcpp::QoS(10));
 
-    using namespace std::chrono_literals;
-    // FIXME: Hardcoded timer period
-    control_timer_ =
-        node_ptr_->create_wall_timer(10ms, std::bind(&ControllerBase::control_timer_callback, this));
+    double bypass_keep_alive_freq = 0.0;
+    node_ptr_->get_parameter("bypass_keep_alive_freq", bypass_keep_alive_freq);
+    if (bypass_keep_alive_freq > 0.0)
+      bypass_keep_alive_ns_ = static_cast<int64_t>(1e9 / bypass_keep_alive_freq);
+
+    node_ptr_->get_parameter("publish_info_freq", info_freq_);
+    diagnostics_pub_ = node_ptr_->create_publisher<diagnostic_msgs::msg::DiagnosticArray>(
+        "/diagnostics", rclcpp::QoS(10));
+    if (info_freq_ > 0.0)
+    {
+      diagnostics_timer_ = node_ptr_->create_wall_timer(
+          std::chrono::duration<double>(1.0 / info_freq_),
+          std::bind(&ControllerBase::diagnostics_timer_callback, this), service_callback_group_);
+    }
+
+    openFlightRecorder();
+
+    platform_graph_event_ = node_ptr_->get_graph_event();
+    platform_discovery_timer_ = node_ptr_->create_wall_timer(
+        std::chrono::milliseconds(500),
+        std::bind(&ControllerBase::platform_discovery_timer_callback, this), service_callback_group_);
 
     set_control_mode_srv_ = node_ptr->create_service<as2_msgs::srv::SetControlMode>(
         as2_names::services::controller::set_control_mode,
         std::bind(&ControllerBase::setControlModeSrvCall, this,
+                  std::placeholders::_1, // Corresponds to the 'request_header' input
+                  std::placeholders::_2  // Corresponds to the 'request' input
+                  ),
+        rmw_qos_profile_services_default, service_callback_group_);
+
+    list_compatible_modes_srv_ = node_ptr->create_service<as2_msgs::srv::ListControlModes>(
+        "controller/list_compatible_control_modes",
+        std::bind(&ControllerBase::listCompatibleControlModesSrvCall, this,
                   std::placeholders::_1, // Corresponds to the 'request'  input
                   std::placeholders::_2  // Corresponds to the 'response' input
-                  ));
+                  ),
+        rmw_qos_profile_services_default, service_callback_group_);
 
     input_mode_.control_mode = as2_msgs::msg::ControlMode::UNSET;
     output_mode_.control_mode = as2_msgs::msg::ControlMode::UNSET;
 
-    ownInitialize();
+    ownInitialize();
+    // the plugin bounds may depend on its own parameters
+    updateRateBounds(*this);
+
+    // after ownInitialize, so the plugin does not validate its own declarations
+    parameters_callback_handle_ = node_ptr_->add_on_set_parameters_callback(
+        std::bind(&ControllerBase::parametersCallback, this, std::placeholders::_1));
+  }
+
+  void ControllerBase::initializeStandby(as2::Node *node_ptr)
+  {
+    // no subscriptions, publishers nor timers: the inputs and outputs stay with the controller
+    // the plugin is swapped into
+    node_ptr_ = node_ptr;
+    ownInitialize();
+  }
+
+  bool ControllerBase::swapPlugin(std::shared_ptr<ControllerBase> next_plugin, std::string &reason)
+  {
+    ControllerBase &next = next_plugin ? *next_plugin : *this;
+
+    // the negotiation state is only touched by the service callback group, as the swap
+    if (negotiation_state_ != ModeNegotiationState::IDLE)
+    {
+      reason = "a control mode negotiation is pending";
+      return false;
+    }
+
+    // the tick holds the mode mutex, so the swap always happens between two ticks
+    std::lock_guard<std::mutex> mode_lock(mode_mutex_);
+    // the stages of both plugins stop until the next tick
+    ControllerBase &current = plugin();
+    const auto current_stage_locks = current.lockComputeStages();
+    const auto next_stage_locks = &next != &current ? next.lockComputeStages()
+                                                    : std::vector<std::unique_lock<std::mutex>>();
+    current.stages_active_ = false;
+    next.stages_active_ = false;
+    if (control_mode_established_)
+    {
+      auto unset_mode = as2::convertUint8tToAS2ControlMode(UNSET_MODE_MASK);
+      const bool mode_set = bypass_controller_ ? next.setMode(unset_mode, unset_mode)
+                                               : next.setMode(input_mode_, output_mode_);
+      if (!mode_set)
+      {
+        reason = "the new plugin does not accept mode " + as2::controlModeToString(input_mode_);
+        RCLCPP_ERROR(node_ptr_->get_logger(), "Swap rejected, %s", reason.c_str());
+        return false;
+      }
+    }
+
+    // warm the new plugin with the inputs the current one has seen, so the next tick can
+    // command right away
+    if (!bypass_controller_)
+    {
+      const auto &state = state_buffer_.read();
+      if (state.pose && state.twist)
+        next.updateState(interpolate_state_ ? interpolated_pose_ : *state.pose,
+                         interpolate_state_ ? interpolated_twist_ : *state.twist);
+      if (ref_pose_buffer_.read())
+        next.updateReference(*ref_pose_buffer_.read());
+      if (ref_twist_buffer_.read())
+        next.updateReference(*ref_twist_buffer_.read());
+      if (ref_thrust_buffer_.read())
+        next.updateReference(*ref_thrust_buffer_.read());
+      if (traj_reference_sampled_)
+        next.updateReference(traj_reference_);
+      else if (ref_traj_buffer_.read())
+        next.updateReference(*ref_traj_buffer_.read());
+    }
+
+    // the new plugin starts at full fidelity, the governor steps it down again if needed
+    updateRateBounds(next);
+    governor_.fidelity_level = 0;
+    fidelity_level_ = 0;
+    next.setFidelityLevel(0);
+
+    std::atomic_store(&active_plugin_, std::move(next_plugin));
+    return true;
+  }
+
+  void ControllerBase::addComputeStage(const std::string &name, const double freq,
+                                       const int priority, std::function<void()> compute)
+  {
+    if (freq <= 0.0)
+    {
+      RCLCPP_ERROR(node_ptr_->get_logger(), "Compute stage %s: invalid frequency %f", name.c_str(),
+                   freq);
+      return;
+    }
+    auto stage = std::make_unique<ComputeStage>();
+    stage->name = name;
+    stage->freq = freq;
+    stage->priority = priority;
+    stage->period_ns = static_cast<int64_t>(1e9 / freq);
+    stage->compute = std::move(compute);
+    stage->callback_group = node_ptr_->create_callback_group(rclcpp::CallbackGroupType::MutuallyExclusive);
+    ComputeStage &stage_ref = *stage;
+    stage->timer = rclcpp::create_timer(node_ptr_, node_ptr_->get_clock(),
+                                        rclcpp::Duration::from_nanoseconds(stage->period_ns),
+                                        [this, &stage_ref]() { runComputeStage(stage_ref); },
+                                        stage->callback_group);
+    RCLCPP_INFO(node_ptr_->get_logger(), "Compute stage %s at %.1f Hz, priority %d", name.c_str(),
+                freq, priority);
+    compute_stages_.push_back(std::move(stage));
+  }
+
+  void ControllerBase::runComputeStage(ComputeStage &stage)
+  {
+    if (!stages_active_.load(std::memory_order_acquire))
+      return;
+    std::lock_guard<std::mutex> stage_lock(stage.mutex);
+    // a mode change may have stopped the stages while waiting
+    if (!stages_active_.load(std::memory_order_acquire))
+      return;
+
+    const auto compute_start = std::chrono::steady_clock::now();
+    stage.compute();
+    const int64_t compute_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now() - compute_start)
+                                   .count();
+    stage.stats.record(compute_ns);
+    if (compute_ns > stage.period_ns)
+      stage.overruns++;
+  }
+
+  std::vector<std::unique_lock<std::mutex>> ControllerBase::lockComputeStages()
+  {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(compute_stages_.size());
+    for (auto &stage : compute_stages_)
+      locks.emplace_back(stage->mutex);
+    return locks;
+  }
+
+  // runs on the thread setting the parameters, never blocks the control loop
+  rcl_interfaces::msg::SetParametersResult ControllerBase::parametersCallback(
+      const std::vector<rclcpp::Parameter> &parameters)
+  {
+    rcl_interfaces::msg::SetParametersResult result;
+    const auto active_plugin = std::atomic_load(&active_plugin_);
+    ControllerBase &target = active_plugin ? *active_plugin : *this;
+    result.successful = target.updateParameters(parameters, result.reason);
+    if (!result.successful)
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "Parameter update rejected: %s", result.reason.c_str());
+    }
+    return result;
+  }
+
+  void ControllerBase::startControlTimer()
+  {
+    // one shot: the phase delay has elapsed, tick now and then every period
+    if (control_start_timer_)
+    {
+      control_start_timer_->cancel();
+      control_start_timer_.reset();
+      control_timer_callback();
+    }
+    // node clock based timer, so it follows sim time when use_sim_time is set
+    control_timer_ = rclcpp::create_timer(node_ptr_, node_ptr_->get_clock(), control_period_,
+                                          std::bind(&ControllerBase::control_timer_callback, this),
+                                          control_callback_group_);
+  }
+
+  rclcpp::QoS ControllerBase::topicQoS(const std::string &topic_class, rclcpp::QoS qos) const
+  {
+    std::string reliability = "default";
+    int depth = 0;
+    double deadline = 0.0, lifespan = 0.0;
+    node_ptr_->get_parameter("qos." + topic_class + ".reliability", reliability);
+    node_ptr_->get_parameter("qos." + topic_class + ".depth", depth);
+    node_ptr_->get_parameter("qos." + topic_class + ".deadline", deadline);
+    node_ptr_->get_parameter("qos." + topic_class + ".lifespan", lifespan);
+    // lifespan is applied by the writer, the subscribed topics are written by other nodes
+    if (lifespan > 0.0 && topic_class != "command")
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(),
+                  "qos.%s.lifespan ignored, it only applies to the published command topics",
+                  topic_class.c_str());
+      lifespan = 0.0;
+    }
+
+    if (depth > 0)
+      qos.keep_last(depth);
+    if (reliability == "best_effort")
+      qos.best_effort();
+    else if (reliability == "reliable")
+      qos.reliable();
+    else if (reliability != "default")
+      RCLCPP_WARN(node_ptr_->get_logger(), "Unknown qos.%s.reliability '%s', using default",
+                  topic_class.c_str(), reliability.c_str());
+    if (deadline > 0.0)
+      qos.deadline(rclcpp::Duration::from_seconds(deadline));
+    // the publisher drops its samples once older than this, so they are not delivered on
+    // retransmissions or to late joining readers
+    if (lifespan > 0.0)
+      qos.lifespan(rclcpp::Duration::from_seconds(lifespan));
+    return qos;
+  }
+
+  rclcpp::SubscriptionOptions ControllerBase::deadlineOptions(const rclcpp::SubscriptionOptions &options,
+                                                              const rclcpp::QoS &qos,
+                                                              std::atomic<uint8_t> &missed,
+                                                              const uint8_t topics)
+  {
+    const rmw_time_t deadline = qos.get_rmw_qos_profile().deadline;
+    if (deadline.sec == 0 && deadline.nsec == 0)
+      return options;
+
+    // served by the input callback group, as the messages that clear the bits
+    deadline_monitoring_ = true;
+    rclcpp::SubscriptionOptions deadline_options = options;
+    deadline_options.event_callbacks.deadline_callback =
+        [&missed, topics](rclcpp::QOSDeadlineRequestedInfo &)
+    {
+      missed.fetch_or(topics, std::memory_order_relaxed);
+    };
+    return deadline_options;
+  }
+
+  void ControllerBase::setupStateSubscriptions(const rclcpp::SubscriptionOptions &options)
+  {
+    std::string sync_policy = "approximate";
+    std::string state_source = "pose_twist";
+    std::string odometry_topic = "self_localization/odom";
+    int queue_size = 5;
+    node_ptr_->get_parameter("state_sync_policy", sync_policy);
+    node_ptr_->get_parameter("state_sync_queue_size", queue_size);
+    node_ptr_->get_parameter("state_source", state_source);
+    node_ptr_->get_parameter("odometry_topic", odometry_topic);
+
+    if (sync_policy != "approximate" && sync_policy != "exact" && sync_policy != "latest" &&
+        sync_policy != "interpolate")
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "Unknown state_sync_policy '%s', using approximate",
+                  sync_policy.c_str());
+      sync_policy = "approximate";
+    }
+    if (queue_size < 1)
+      queue_size = 1;
+    interpolate_state_ = sync_policy == "interpolate";
+    const rclcpp::QoS state_qos = topicQoS("state", as2_names::topics::self_localization::qos);
+    const auto pose_options = deadlineOptions(options, state_qos, state_deadline_missed_, POSE_TOPIC);
+    const auto twist_options = deadlineOptions(options, state_qos, state_deadline_missed_, TWIST_TOPIC);
+
+    if (state_source == "odometry")
+    {
+      // pose and twist already come together, only interpolate makes a difference
+      odometry_poses_ = MessageRing<geometry_msgs::msg::PoseStamped>(message_pool_size_);
+      odometry_twists_ = MessageRing<geometry_msgs::msg::TwistStamped>(message_pool_size_);
+      odometry_sub_ = createPooledSubscription<nav_msgs::msg::Odometry>(
+          odometry_topic, state_qos,
+          std::bind(&ControllerBase::odometry_callback, this, std::placeholders::_1),
+          deadlineOptions(options, state_qos, state_deadline_missed_, POSE_TOPIC | TWIST_TOPIC));
+      RCLCPP_INFO(node_ptr_->get_logger(), "State from odometry topic %s, policy %s",
+                  odometry_topic.c_str(), sync_policy.c_str());
+      return;
+    }
+    if (state_source != "pose_twist")
+      RCLCPP_WARN(node_ptr_->get_logger(), "Unknown state_source '%s', using pose_twist",
+                  state_source.c_str());
+
+    if (sync_policy == "approximate" || sync_policy == "exact")
+    {
+      pose_sub_ = std::make_shared<message_filters::Subscriber<geometry_msgs::msg::PoseStamped>>(node_ptr_, as2_names::topics::self_localization::pose, state_qos.get_rmw_qos_profile(), pose_options);
+      twist_sub_ = std::make_shared<message_filters::Subscriber<geometry_msgs::msg::TwistStamped>>(node_ptr_, as2_names::topics::self_localization::twist, state_qos.get_rmw_qos_profile(), twist_options);
+      if (sync_policy == "exact")
+      {
+        exact_synchronizer_ = std::make_shared<message_filters::Synchronizer<exact_policy>>(exact_policy(queue_size), *(pose_sub_.get()), *(twist_sub_.get()));
+        exact_synchronizer_->registerCallback(&ControllerBase::state_callback, this);
+      }
+      else
+      {
+        synchronizer_ = std::make_shared<message_filters::Synchronizer<approximate_policy>>(approximate_policy(queue_size), *(pose_sub_.get()), *(twist_sub_.get()));
+        synchronizer_->registerCallback(&ControllerBase::state_callback, this);
+      }
+    }
+    else
+    {
+      state_pose_sub_ = createPooledSubscription<geometry_msgs::msg::PoseStamped>(
+          as2_names::topics::self_localization::pose, state_qos,
+          std::bind(&ControllerBase::state_pose_callback, this, std::placeholders::_1), pose_options);
+      state_twist_sub_ = createPooledSubscription<geometry_msgs::msg::TwistStamped>(
+          as2_names::topics::self_localization::twist, state_qos,
+          std::bind(&ControllerBase::state_twist_callback, this, std::placeholders::_1), twist_options);
+    }
+    RCLCPP_INFO(node_ptr_->get_logger(), "State from pose and twist topics, policy %s",
+                sync_policy.c_str());
+  }
+
+  // input callbacks only store the messages, the plugin is updated from the control loop.
+  // Message pointers are moved into the buffers, so nothing is copied or allocated and old
+  // messages are always released on the input thread
+
+  void ControllerBase::state_callback(const geometry_msgs::msg::PoseStamped::ConstSharedPtr pose_msg,
+                                      const geometry_msgs::msg::TwistStamped::ConstSharedPtr twist_msg)
+  {
+    CONTROLLER_TRACEPOINT(state_callback, this, tracing::stampNs(pose_msg->header.stamp),
+                          tracing::stampNs(twist_msg->header.stamp));
+    storeState(pose_msg, twist_msg);
+
+    if (control_on_state_)
+      control_timer_callback();
+  }
+
+  void ControllerBase::storeState(const geometry_msgs::msg::PoseStamped::ConstSharedPtr &pose_msg,
+                                  const geometry_msgs::msg::TwistStamped::ConstSharedPtr &twist_msg)
+  {
+    if (pose_msg != last_pose_)
+    {
+      prev_pose_ = std::move(last_pose_);
+      last_pose_ = pose_msg;
+      state_deadline_missed_.fetch_and(static_cast<uint8_t>(~POSE_TOPIC), std::memory_order_relaxed);
+    }
+    if (twist_msg != last_twist_)
+    {
+      prev_twist_ = std::move(last_twist_);
+      last_twist_ = twist_msg;
+      state_deadline_missed_.fetch_and(static_cast<uint8_t>(~TWIST_TOPIC), std::memory_order_relaxed);
+    }
+
+    auto &state = state_buffer_.writeBuffer();
+    state.pose = last_pose_;
+    state.twist = last_twist_;
+    state.prev_pose = prev_pose_;
+    state.prev_twist = prev_twist_;
+    state_buffer_.publish();
+  }
+
+  // shared memory transport: the state is polled by the control loop itself, which then is
+  // both the writer and the reader of the state buffer. Samples alternate between two
+  // preallocated messages so the previous one stays valid for the interpolation
+  void ControllerBase::storeSharedMemoryState()
+  {
+    const shm::StateSample &sample = shm_state_sample_;
+    auto &pose = *shm_pose_[shm_slot_];
+    auto &twist = *shm_twist_[shm_slot_];
+    const rclcpp::Time stamp(sample.stamp_ns, RCL_ROS_TIME);
+
+    pose.header.stamp = stamp;
+    pose.header.frame_id = sample.pose_frame_id;
+    pose.pose.position.x = sample.position[0];
+    pose.pose.position.y = sample.position[1];
+    pose.pose.position.z = sample.position[2];
+    pose.pose.orientation.x = sample.orientation[0];
+    pose.pose.orientation.y = sample.orientation[1];
+    pose.pose.orientation.z = sample.orientation[2];
+    pose.pose.orientation.w = sample.orientation[3];
+
+    twist.header.stamp = stamp;
+    twist.header.frame_id = sample.twist_frame_id;
+    twist.twist.linear.x = sample.linear[0];
+    twist.twist.linear.y = sample.linear[1];
+    twist.twist.linear.z = sample.linear[2];
+    twist.twist.angular.x = sample.angular[0];
+    twist.twist.angular.y = sample.angular[1];
+    twist.twist.angular.z = sample.angular[2];
+
+    storeState(shm_pose_[shm_slot_], shm_twist_[shm_slot_]);
+    shm_slot_ ^= 1;
+  }
+
+  void ControllerBase::writeSharedMemoryCommand(const uint8_t mask,
+                                                const geometry_msgs::msg::PoseStamped &pose,
+                                                const geometry_msgs::msg::TwistStamped &twist,
+                                                const as2_msgs::msg::Thrust &thrust)
+  {
+    shm::CommandSample &sample = shm_command_sample_;
+    sample.stamp_ns = node_ptr_->now().nanoseconds();
+    sample.mask = mask;
+    sample.position[0] = pose.pose.position.x;
+    sample.position[1] = pose.pose.position.y;
+    sample.position[2] = pose.pose.position.z;
+    sample.orientation[0] = pose.pose.orientation.x;
+    sample.orientation[1] = pose.pose.orientation.y;
+    sample.orientation[2] = pose.pose.orientation.z;
+    sample.orientation[3] = pose.pose.orientation.w;
+    sample.linear[0] = twist.twist.linear.x;
+    sample.linear[1] = twist.twist.linear.y;
+    sample.linear[2] = twist.twist.linear.z;
+    sample.angular[0] = twist.twist.angular.x;
+    sample.angular[1] = twist.twist.angular.y;
+    sample.angular[2] = twist.twist.angular.z;
+    sample.thrust = thrust.thrust;
+    shm::copyFrameId(sample.pose_frame_id, pose.header.frame_id);
+    shm::copyFrameId(sample.twist_frame_id, twist.header.frame_id);
+    shm_transport_->writeCommand(sample);
+  }
+
+  // latest policy: every sample is paired with the newest one of the other stream, no waiting
+
+  // latest and interpolate: every message updates the state, the state triggered loop ticks
+  // once both halves were renewed
+  void ControllerBase::state_pose_callback(geometry_msgs::msg::PoseStamped::ConstSharedPtr msg)
+  {
+    latest_state_topics_ |= POSE_TOPIC;
+    if (last_twist_)
+      storeLatestState(msg, last_twist_);
+    else
+      last_pose_ = std::move(msg);
+  }
+
+  void ControllerBase::state_twist_callback(geometry_msgs::msg::TwistStamped::ConstSharedPtr msg)
+  {
+    latest_state_topics_ |= TWIST_TOPIC;
+    if (last_pose_)
+      storeLatestState(last_pose_, msg);
+    else
+      last_twist_ = std::move(msg);
+  }
+
+  void ControllerBase::storeLatestState(const geometry_msgs::msg::PoseStamped::ConstSharedPtr pose_msg,
+                                        const geometry_msgs::msg::TwistStamped::ConstSharedPtr twist_msg)
+  {
+    storeState(pose_msg, twist_msg);
+    if (latest_state_topics_ != (POSE_TOPIC | TWIST_TOPIC))
+      return;
+    latest_state_topics_ = 0;
+    CONTROLLER_TRACEPOINT(state_callback, this, tracing::stampNs(pose_msg->header.stamp),
+                          tracing::stampNs(twist_msg->header.stamp));
+    if (control_on_state_)
+      control_timer_callback();
+  }
+
+  // odometry carries both halves of the state with a single stamp, the twist keeps the
+  // child frame it is expressed in
+  void ControllerBase::odometry_callback(nav_msgs::msg::Odometry::ConstSharedPtr msg)
+  {
+    // the halves reuse the messages released by the state buffer
+    auto pose = odometry_poses_.acquire();
+    pose->header = msg->header;
+    pose->pose = msg->pose.pose;
+
+    auto twist = odometry_twists_.acquire();
+    twist->header.stamp = msg->header.stamp;
+    twist->header.frame_id = msg->child_frame_id.empty() ? msg->header.frame_id : msg->child_frame_id;
+    twist->twist = msg->twist.twist;
+
+    state_callback(pose, twist);
+  }
+
+  void ControllerBase::ref_pose_callback(geometry_msgs::msg::PoseStamped::SharedPtr msg)
+  {
+    ref_pose_buffer_.writeBuffer() = std::move(msg);
+    ref_pose_buffer_.publish();
+    reference_deadline_missed_.fetch_and(static_cast<uint8_t>(~POSE_TOPIC), std::memory_order_relaxed);
+    if (forward_on_reference_.load(std::memory_order_relaxed))
+      referenceEventTick();
+  }
+
+  void ControllerBase::ref_twist_callback(geometry_msgs::msg::TwistStamped::SharedPtr msg)
+  {
+    ref_twist_buffer_.writeBuffer() = std::move(msg);
+    ref_twist_buffer_.publish();
+    reference_deadline_missed_.fetch_and(static_cast<uint8_t>(~TWIST_TOPIC), std::memory_order_relaxed);
+    if (forward_on_reference_.load(std::memory_order_relaxed))
+      referenceEventTick();
+  }
+
+  void ControllerBase::ref_thrust_callback(as2_msgs::msg::Thrust::SharedPtr msg)
+  {
+    ref_thrust_buffer_.writeBuffer() = std::move(msg);
+    ref_thrust_buffer_.publish();
+    reference_deadline_missed_.fetch_and(static_cast<uint8_t>(~THRUST_TOPIC), std::memory_order_relaxed);
+    if (forward_on_reference_.load(std::memory_order_relaxed))
+      referenceEventTick();
+  }
+
+  void ControllerBase::ref_traj_callback(
+      trajectory_msgs::msg::JointTrajectoryPoint::SharedPtr msg)
+  {
+    ref_traj_buffer_.writeBuffer() = std::move(msg);
+    ref_traj_buffer_.publish();
+    reference_deadline_missed_.fetch_and(static_cast<uint8_t>(~TRAJECTORY_TOPIC),
+                                         std::memory_order_relaxed);
+  }
+
+  void ControllerBase::ref_traj_batch_callback(trajectory_msgs::msg::JointTrajectory::SharedPtr msg)
+  {
+    // point times are relative to the header stamp, unstamped batches start when received
+    if (msg->header.stamp.sec == 0 && msg->header.stamp.nanosec == 0)
+      msg->header.stamp = node_ptr_->now();
+    ref_traj_batch_buffer_.writeBuffer() = std::move(msg);
+    ref_traj_batch_buffer_.publish();
+    reference_deadline_missed_.fetch_and(static_cast<uint8_t>(~TRAJECTORY_BATCH_TOPIC),
+                                         std::memory_order_relaxed);
+  }
+
+  void ControllerBase::platform_info_callback(as2_msgs::msg::PlatformInfo::SharedPtr msg)
+  {
+    platform_info_buffer_.writeBuffer() = std::move(msg);
+    platform_info_buffer_.publish();
+  }
+
+  void ControllerBase::consumeInputs()
+  {
+    platform_info_buffer_.update();
+
+    if (shm_transport_ && shm_transport_->readState(shm_state_sample_))
+      storeSharedMemoryState();
+
+    // handed to the plugin in a single call once everything new has been collected
+    TickInputs inputs;
+
+    if (state_buffer_.update())
+    {
+      state_adquired_ = true;
+      if (flight_recorder_)
+        recordMessages(recorder::STATE, state_buffer_.read().pose.get(),
+                       state_buffer_.read().twist.get(), nullptr);
+      if (!interpolate_state_)
+      {
+        inputs.pose = state_buffer_.read().pose.get();
+        inputs.twist = state_buffer_.read().twist.get();
+      }
+    }
+
+    // the interpolated state changes on every tick, even without new samples
+    if (state_adquired_ && !bypass_controller_ && interpolate_state_)
+    {
+      interpolateState(node_ptr_->now());
+      inputs.pose = &interpolated_pose_;
+      inputs.twist = &interpolated_twist_;
+    }
+
+    ref_pose_fresh_ = ref_pose_buffer_.update();
+    if (ref_pose_fresh_)
+    {
+      motion_reference_adquired_ = true;
+      reference_topics_ |= POSE_TOPIC;
+      last_reference_stamp_ = ref_pose_buffer_.read()->header.stamp;
+      inputs.ref_pose = ref_pose_buffer_.read().get();
+      if (flight_recorder_)
+        recordMessages(recorder::REFERENCE_POSE, inputs.ref_pose, nullptr, nullptr);
+    }
+
+    ref_twist_fresh_ = ref_twist_buffer_.update();
+    if (ref_twist_fresh_)
+    {
+      motion_reference_adquired_ = true;
+      reference_topics_ |= TWIST_TOPIC;
+      last_reference_stamp_ = ref_twist_buffer_.read()->header.stamp;
+      inputs.ref_twist = ref_twist_buffer_.read().get();
+      if (flight_recorder_)
+        recordMessages(recorder::REFERENCE_TWIST, nullptr, inputs.ref_twist, nullptr);
+    }
+
+    ref_thrust_fresh_ = ref_thrust_buffer_.update();
+    if (ref_thrust_fresh_)
+    {
+      motion_reference_adquired_ = true;
+      reference_topics_ |= THRUST_TOPIC;
+      last_reference_stamp_ = ref_thrust_buffer_.read()->header.stamp;
+      inputs.ref_thrust = ref_thrust_buffer_.read().get();
+      if (flight_recorder_)
+        recordMessages(recorder::REFERENCE_THRUST, nullptr, nullptr, inputs.ref_thrust);
+    }
+
+    if (ref_traj_buffer_.update())
+    {
+      // a single setpoint replaces any buffered trajectory
+      trajectory_buffer_.clear();
+      traj_reference_sampled_ = false;
+      motion_reference_adquired_ = true;
+      reference_topics_ |= TRAJECTORY_TOPIC;
+      inputs.ref_traj = ref_traj_buffer_.read().get();
+    }
+
+    if (ref_traj_batch_buffer_.update())
+    {
+      const auto &batch = *ref_traj_batch_buffer_.read();
+      const rclcpp::Time start(batch.header.stamp);
+      trajectory_buffer_.merge(batch, start.nanoseconds());
+      reference_topics_ |= TRAJECTORY_BATCH_TOPIC;
+      if (!batch.points.empty())
+      {
+        motion_reference_adquired_ = true;
+        last_reference_stamp_ = start;
+      }
+    }
+
+    // the buffered trajectory is sampled at the tick time
+    if (!trajectory_buffer_.empty() && !bypass_controller_ &&
+        trajectory_buffer_.evaluate(node_ptr_->now().nanoseconds(), traj_reference_))
+    {
+      inputs.ref_traj = &traj_reference_;
+      traj_reference_sampled_ = true;
+    }
+    if (inputs.ref_traj && flight_recorder_)
+      recordTrajectory(*inputs.ref_traj);
+
+    if (!bypass_controller_ &&
+        (inputs.pose || inputs.ref_pose || inputs.ref_twist || inputs.ref_thrust || inputs.ref_traj))
+      plugin().dispatchInputs(inputs);
+  }
+
+  void ControllerBase::dispatchCompute(geometry_msgs::msg::PoseStamped &pose,
+                                       geometry_msgs::msg::TwistStamped &twist,
+                                       as2_msgs::msg::Thrust &thrust)
+  {
+    computeOutput(pose, twist, thrust);
+  }
+
+  void ControllerBase::dispatchInputs(const TickInputs &inputs)
+  {
+    if (inputs.pose)
+    {
+      CONTROLLER_TRACEPOINT(update_state_entry, this, tracing::stampNs(inputs.pose->header.stamp));
+      updateState(*inputs.pose, *inputs.twist);
+      CONTROLLER_TRACEPOINT(update_state_exit, this, tracing::stampNs(inputs.pose->header.stamp));
+    }
+    if (inputs.ref_pose)
+      traceReference(tracing::POSE, inputs.ref_pose->header.stamp,
+                     [&]() { updateReference(*inputs.ref_pose); });
+    if (inputs.ref_twist)
+      traceReference(tracing::TWIST, inputs.ref_twist->header.stamp,
+                     [&]() { updateReference(*inputs.ref_twist); });
+    if (inputs.ref_thrust)
+      traceReference(tracing::THRUST, inputs.ref_thrust->header.stamp,
+                     [&]() { updateReference(*inputs.ref_thrust); });
+    // trajectory points are not stamped
+    if (inputs.ref_traj)
+      traceReference(tracing::TRAJECTORY, builtin_interfaces::msg::Time(),
+                     [&]() { updateReference(*inputs.ref_traj); });
+  }
+
+  // estimate the state at the given stamp from the last two samples of each stream. Runs on
+  // the control thread and only writes into the preallocated messages
+  void ControllerBase::interpolateState(const rclcpp::Time &stamp)
+  {
+    const auto &state = state_buffer_.read();
+    interpolated_pose_.header.frame_id = state.pose->header.frame_id;
+    interpolated_twist_.header.frame_id = state.twist->header.frame_id;
+    interpolated_pose_.header.stamp = stamp;
+    interpolated_twist_.header.stamp = stamp;
+
+    if (state.prev_pose)
+    {
+      const auto &p0 = state.prev_pose->pose;
+      const auto &p1 = state.pose->pose;
+      const double t = interpolationFactor(state.prev_pose->header.stamp, state.pose->header.stamp, stamp);
+      interpolated_pose_.pose.position.x = p0.position.x + (p1.position.x - p0.position.x) * t;
+      interpolated_pose_.pose.position.y = p0.position.y + (p1.position.y - p0.position.y) * t;
+      interpolated_pose_.pose.position.z = p0.position.z + (p1.position.z - p0.position.z) * t;
+      slerp(p0.orientation, p1.orientation, t, interpolated_pose_.pose.orientation);
+    }
+    else
+      interpolated_pose_.pose = state.pose->pose;
+
+    if (state.prev_twist)
+    {
+      const auto &v0 = state.prev_twist->twist;
+      const auto &v1 = state.twist->twist;
+      const double t = interpolationFactor(state.prev_twist->header.stamp, state.twist->header.stamp, stamp);
+      lerp(v0.linear, v1.linear, t, interpolated_twist_.twist.linear);
+      lerp(v0.angular, v1.angular, t, interpolated_twist_.twist.angular);
+    }
+    else
+      interpolated_twist_.twist = state.twist->twist;
+  }
+
+  void ControllerBase::control_timer_callback()
+  {
+    CONTROLLER_TRACEPOINT(control_tick_start, this, node_ptr_->now().nanoseconds());
+    if (!control_on_state_)
+    {
+      updateControlDeadline();
+    }
+
+    // mode swaps from the negotiation only happen between ticks
+    std::lock_guard<std::mutex> mode_lock(mode_mutex_);
+
+    const bool ready = prepareTick();
+    plugin().stages_active_.store(ready && !bypass_controller_, std::memory_order_release);
+    if (!ready)
+    {
+      return;
+    }
+
+    sendCommand();
+
+    if (!control_on_state_ && node_ptr_->now() > next_deadline_)
+    {
+      // the tick finished after the next deadline
+      overrun_count_++;
+    }
+
+    if (governor_.enabled)
+    {
+      governRate();
+    }
+  };
+
+  bool ControllerBase::prepareTick()
+  {
+    consumeInputs();
+
+    const auto &platform_info = platform_info_buffer_.read();
+    if (!platform_info || !platform_info->offboard || !platform_info->armed)
+    {
+      return false;
+    }
+
+    if (!control_mode_established_)
+    {
+      return false;
+    }
+
+    if (!state_adquired_)
+    {
+      auto &clock = *node_ptr_->get_clock();
+      RCLCPP_INFO_THROTTLE(node_ptr_->get_logger(), clock, 1000, "Waiting for odometry ");
+
+      return false;
+    }
+
+    if (!checkWatchdog())
+    {
+      applyFailsafe();
+      return false;
+    }
+    return true;
+  }
+
+  // age of the newest input of each kind against its deadline, from the message stamps.
+  // Inputs stamped with another clock or not stamped at all are not supervised
+  static inline bool isStale(const rclcpp::Time &now, const rclcpp::Time &stamp, const int64_t timeout_ns)
+  {
+    return timeout_ns > 0 && stamp.nanoseconds() > 0 && stamp.get_clock_type() == now.get_clock_type() &&
+           (now - stamp).nanoseconds() > timeout_ns;
+  }
+
+  bool ControllerBase::checkWatchdog()
+  {
+    if (state_timeout_ns_ == 0 && reference_timeout_ns_ == 0 && !deadline_monitoring_)
+      return true;
+
+    const rclcpp::Time now = node_ptr_->now();
+    // the state is not used while bypassing
+    const bool state_stale =
+        !bypass_controller_ &&
+        (isStale(now, state_buffer_.read().pose->header.stamp, state_timeout_ns_) ||
+         state_deadline_missed_.load(std::memory_order_relaxed) != 0);
+    const bool reference_stale =
+        motion_reference_adquired_ &&
+        (isStale(now, last_reference_stamp_, reference_timeout_ns_) ||
+         (reference_deadline_missed_.load(std::memory_order_relaxed) & reference_topics_) != 0);
+    if (!state_stale && !reference_stale)
+    {
+      if (watchdog_tripped_)
+      {
+        watchdog_tripped_ = false;
+        publishWatchdogEvent(diagnostic_msgs::msg::DiagnosticStatus::OK, "Inputs recovered");
+        RCLCPP_INFO(node_ptr_->get_logger(), "Watchdog: inputs recovered");
+      }
+      return true;
+    }
+
+    if (!watchdog_tripped_)
+    {
+      watchdog_tripped_ = true;
+      watchdog_trips_++;
+      const char *input = state_stale ? (reference_stale ? "State and reference" : "State") : "Reference";
+      const bool zero_thrust =
+          watchdog_action_ == WatchdogAction::ZERO_THRUST && (publish_mask_ & THRUST_COMMAND);
+      const std::string message =
+          std::string(input) + " stale, " +
+          (watchdog_action_ == WatchdogAction::HOVER         ? "requesting hover"
+           : zero_thrust                                     ? "zero thrust"
+           : watchdog_action_ == WatchdogAction::ZERO_THRUST ? "holding, the output mode takes no thrust"
+                                                             : "holding");
+      publishWatchdogEvent(diagnostic_msgs::msg::DiagnosticStatus::ERROR, message);
+      RCLCPP_ERROR(node_ptr_->get_logger(), "Watchdog: %s", message.c_str());
+      if (flight_recorder_)
+      {
+        recordMessages(recorder::FAILSAFE, nullptr, nullptr, nullptr);
+        flight_dump_requested_ = true;
+      }
+      if (watchdog_action_ == WatchdogAction::HOVER)
+        requestHover();
+    }
+    return false;
+  }
+
+  // commands while the watchdog is tripped. hold stops commanding, the platform keeps its last
+  // command. hover is requested once, when tripping
+  void ControllerBase::applyFailsafe()
+  {
+    // zero thrust only reaches a platform whose output mode takes thrust, otherwise hold
+    if (watchdog_action_ != WatchdogAction::ZERO_THRUST || !(publish_mask_ & THRUST_COMMAND))
+      return;
+
+    command_thrust_.header.stamp = node_ptr_->now();
+    command_thrust_.thrust = 0.0;
+    if (flight_recorder_)
+      recordMessages(recorder::COMMAND, nullptr, nullptr, &command_thrust_, THRUST_COMMAND);
+    if (shm_transport_)
+      writeSharedMemoryCommand(THRUST_COMMAND, command_pose_, command_twist_, command_thrust_);
+    else
+      thrust_pub_->publish(command_thrust_);
+  }
+
+  void ControllerBase::requestHover()
+  {
+    // the controller stops until a new control mode is negotiated
+    control_mode_established_ = false;
+    if (!set_control_mode_client_->service_is_ready())
+    {
+      RCLCPP_ERROR(node_ptr_->get_logger(), "Watchdog: platform set control mode service not available");
+      return;
+    }
+    auto request = std::make_shared<as2_msgs::srv::SetControlMode::Request>();
+    request->control_mode = as2::convertUint8tToAS2ControlMode(HOVER_MODE_MASK);
+    set_control_mode_client_->async_send_request(
+        request,
+        [this](rclcpp::Client<as2_msgs::srv::SetControlMode>::SharedFuture future)
+        {
+          const auto response = future.valid() ? future.get() : nullptr;
+          if (!response)
+            RCLCPP_ERROR(node_ptr_->get_logger(), "Watchdog: no answer to the hover request");
+          else if (!response->success)
+            RCLCPP_ERROR(node_ptr_->get_logger(), "Watchdog: platform rejected hover");
+        });
+  }
+
+  void ControllerBase::publishWatchdogEvent(const uint8_t level, const std::string &message)
+  {
+    diagnostic_msgs::msg::DiagnosticStatus event;
+    event.level = level;
+    event.name = std::string(node_ptr_->get_fully_qualified_name()) + ": watchdog";
+    event.hardware_id = node_ptr_->get_namespace();
+    event.message = message;
+    watchdog_pub_->publish(event);
+  }
+
+  void ControllerBase::openFlightRecorder()
+  {
+    bool enabled = false;
+    int capacity = 8192;
+    std::string file;
+    node_ptr_->get_parameter("flight_recorder.enabled", enabled);
+    node_ptr_->get_parameter("flight_recorder.capacity", capacity);
+    node_ptr_->get_parameter("flight_recorder.file", file);
+    if (!enabled)
+      return;
+
+    if (file.empty())
+    {
+      // $ROS_HOME/flight_recorder/<node name>.bin, one file per controller
+      const char *ros_home = std::getenv("ROS_HOME");
+      const char *home = std::getenv("HOME");
+      std::filesystem::path directory =
+          ros_home ? std::filesystem::path(ros_home) : std::filesystem::path(home ? home : "/tmp") / ".ros";
+      directory /= "flight_recorder";
+      std::error_code ec;
+      std::filesystem::create_directories(directory, ec);
+      std::string name = std::string(node_ptr_->get_fully_qualified_name()).substr(1);
+      std::replace(name.begin(), name.end(), '/', '_');
+      file = (directory / (name + ".bin")).string();
+    }
+
+    auto flight_recorder = std::make_unique<recorder::FlightRecorder>();
+    std::string error;
+    if (!flight_recorder->open(file, static_cast<size_t>(std::max(capacity, 1)), error))
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "Flight recorder disabled: %s", error.c_str());
+      return;
+    }
+    flight_recorder_ = std::move(flight_recorder);
+    RCLCPP_INFO(node_ptr_->get_logger(), "Flight recorder at %s, %d records", file.c_str(),
+                std::max(capacity, 1));
+
+    flight_recorder_timer_ = node_ptr_->create_wall_timer(
+        std::chrono::milliseconds(250),
+        std::bind(&ControllerBase::flight_recorder_timer_callback, this), service_callback_group_);
+    dump_flight_record_srv_ = node_ptr_->create_service<std_srvs::srv::Trigger>(
+        "controller/dump_flight_record",
+        std::bind(&ControllerBase::dumpFlightRecordSrvCall, this, std::placeholders::_1,
+                  std::placeholders::_2),
+        rmw_qos_profile_services_default, service_callback_group_);
+  }
+
+  // stack records, safe from any thread and without allocations
+  void ControllerBase::recordMessages(const uint8_t type,
+                                      const geometry_msgs::msg::PoseStamped *pose,
+                                      const geometry_msgs::msg::TwistStamped *twist,
+                                      const as2_msgs::msg::Thrust *thrust,
+                                      const uint8_t mask)
+  {
+    recorder::Record record{};
+    record.time_ns = node_ptr_->now().nanoseconds();
+    record.type = type;
+    record.mask = mask;
+    if (thrust)
+    {
+      record.stamp_ns = rclcpp::Time(thrust->header.stamp).nanoseconds();
+      record.thrust = thrust->thrust;
+    }
+    if (twist)
+    {
+      record.stamp_ns = rclcpp::Time(twist->header.stamp).nanoseconds();
+      record.linear[0] = twist->twist.linear.x;
+      record.linear[1] = twist->twist.linear.y;
+      record.linear[2] = twist->twist.linear.z;
+      record.angular[0] = twist->twist.angular.x;
+      record.angular[1] = twist->twist.angular.y;
+      record.angular[2] = twist->twist.angular.z;
+    }
+    if (pose)
+    {
+      record.stamp_ns = rclcpp::Time(pose->header.stamp).nanoseconds();
+      record.position[0] = pose->pose.position.x;
+      record.position[1] = pose->pose.position.y;
+      record.position[2] = pose->pose.position.z;
+      record.orientation[0] = pose->pose.orientation.x;
+      record.orientation[1] = pose->pose.orientation.y;
+      record.orientation[2] = pose->pose.orientation.z;
+      record.orientation[3] = pose->pose.orientation.w;
+    }
+    flight_recorder_->write(record);
+  }
+
+  void ControllerBase::recordTrajectory(const trajectory_msgs::msg::JointTrajectoryPoint &point)
+  {
+    recorder::Record record{};
+    record.time_ns = node_ptr_->now().nanoseconds();
+    record.stamp_ns = rclcpp::Duration(point.time_from_start).nanoseconds();
+    record.type = recorder::REFERENCE_TRAJECTORY;
+    for (size_t i = 0; i < 3; i++)
+    {
+      record.position[i] = i < point.positions.size() ? point.positions[i] : 0.0;
+      record.linear[i] = i < point.velocities.size() ? point.velocities[i] : 0.0;
+      record.angular[i] = i < point.accelerations.size() ? point.accelerations[i] : 0.0;
+    }
+    record.thrust = point.positions.size() > 3 ? point.positions[3] : 0.0;
+    flight_recorder_->write(record);
+  }
+
+  void ControllerBase::recordMode(const bool success)
+  {
+    recorder::Record record{};
+    record.time_ns = node_ptr_->now().nanoseconds();
+    record.type = recorder::MODE;
+    record.mask = success ? (bypass_controller_ ? 1 : 2) : 0;
+    record.input_mode = as2::convertAS2ControlModeToUint8t(input_mode_);
+    record.output_mode = as2::convertAS2ControlModeToUint8t(output_mode_);
+    flight_recorder_->write(record);
+  }
+
+  // <file>.<wall time ms>.dump next to the recorder file
+  bool ControllerBase::dumpFlightRecord(std::string &path_or_error)
+  {
+    const auto wall_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                             std::chrono::system_clock::now().time_since_epoch())
+                             .count();
+    const std::string path = flight_recorder_->path() + "." + std::to_string(wall_ms) + ".dump";
+    flight_recorder_->flush();
+    if (!flight_recorder_->dump(path, path_or_error))
+      return false;
+    path_or_error = path;
+    return true;
+  }
+
+  void ControllerBase::flight_recorder_timer_callback()
+  {
+    if (flight_dump_requested_.exchange(false))
+    {
+      std::string result;
+      if (dumpFlightRecord(result))
+        RCLCPP_INFO(node_ptr_->get_logger(), "Flight record dumped to %s", result.c_str());
+      else
+        RCLCPP_ERROR(node_ptr_->get_logger(), "Flight record dump failed: %s", result.c_str());
+    }
+    flight_recorder_->flush();
+  }
+
+  void ControllerBase::dumpFlightRecordSrvCall(
+      const std_srvs::srv::Trigger::Request::SharedPtr request,
+      std_srvs::srv::Trigger::Response::SharedPtr response)
+  {
+    (void)request;
+    response->success = dumpFlightRecord(response->message);
+  }
+
+  void ControllerBase::computeOutputBatch(const std::vector<ControllerBase *> &controllers,
+                                          const PoseTwistBatch &state,
+                                          const PoseTwistBatch &reference,
+                                          CommandBatch &command)
+  {
+    for (size_t i = 0; i < controllers.size(); i++)
+    {
+      ControllerBase &controller = *controllers[i];
+      controller.plugin().dispatchCompute(controller.command_pose_, controller.command_twist_,
+                                          controller.command_thrust_);
+      command.set(i, controller.command_pose_.pose, controller.command_twist_.twist);
+      command.thrust[i] = controller.command_thrust_.thrust;
+      command.pose_frame_id[i] = controller.command_pose_.header.frame_id;
+      command.twist_frame_id[i] = controller.command_twist_.header.frame_id;
+    }
+  }
+
+  void ControllerBase::controlTickBatch(const std::vector<ControllerBase *> &controllers,
+                                        BatchWorkspace &workspace)
+  {
+    workspace.active.clear();
+    workspace.locks.clear();
+    const std::type_info *batch_type = nullptr;
+    for (ControllerBase *controller : controllers)
+    {
+      controller->updateControlDeadline();
+      std::unique_lock<std::mutex> mode_lock(controller->mode_mutex_);
+      const bool ready = controller->prepareTick();
+      controller->plugin().stages_active_.store(ready && !controller->bypass_controller_,
+                                                std::memory_order_release);
+      if (!ready)
+        continue;
+      if (controller->bypass_controller_)
+      {
+        // nothing to compute, the references are forwarded right away
+        controller->sendCommand();
+        continue;
+      }
+      // plugin() only changes under the mode lock, the batch runs the plugin of the first member
+      const std::type_info &type = typeid(controller->plugin());
+      if (!batch_type)
+        batch_type = &type;
+      else if (type != *batch_type)
+      {
+        controller->sendCommand();
+        if (controller->node_ptr_->now() > controller->next_deadline_)
+          controller->overrun_count_++;
+        continue;
+      }
+      workspace.active.push_back(controller);
+      // kept locked until the command is published
+      workspace.locks.push_back(std::move(mode_lock));
+    }
+    if (workspace.active.empty())
+      return;
+
+    const size_t n = workspace.active.size();
+    workspace.state.resize(n);
+    workspace.reference.resize(n);
+    workspace.command.resize(n);
+    for (size_t i = 0; i < n; i++)
+    {
+      const ControllerBase &controller = *workspace.active[i];
+      const auto &snapshot = controller.state_buffer_.read();
+      const auto &pose = controller.interpolate_state_ ? controller.interpolated_pose_ : *snapshot.pose;
+      const auto &twist = controller.interpolate_state_ ? controller.interpolated_twist_ : *snapshot.twist;
+      workspace.state.set(i, pose.pose, twist.twist);
+
+      // rows without a reference of one kind are left at zero
+      const auto &ref_pose = controller.ref_pose_buffer_.read();
+      const auto &ref_twist = controller.ref_twist_buffer_.read();
+      workspace.reference.set(i, ref_pose ? ref_pose->pose : geometry_msgs::msg::Pose(),
+                              ref_twist ? ref_twist->twist : geometry_msgs::msg::Twist());
+
+      workspace.command.pose_frame_id[i] = pose.header.frame_id;
+      workspace.command.twist_frame_id[i] = twist.header.frame_id;
+    }
+
+    const auto compute_start = std::chrono::steady_clock::now();
+    workspace.active.front()->plugin().computeOutputBatch(workspace.active, workspace.state,
+                                                 workspace.reference, workspace.command);
+    // every controller waited for the whole batch
+    const int64_t compute_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now() - compute_start)
+                                   .count();
+
+    for (size_t i = 0; i < n; i++)
+    {
+      ControllerBase &controller = *workspace.active[i];
+      controller.loop_stats_.compute.record(compute_ns);
+      const CommandBatch &command = workspace.command;
+      controller.publishCommand(
+          [&command, i](geometry_msgs::msg::PoseStamped &pose, geometry_msgs::msg::TwistStamped &twist,
+                        as2_msgs::msg::Thrust &thrust)
+          {
+            command.get(i, pose.pose, twist.twist);
+            pose.header.frame_id = command.pose_frame_id[i];
+            twist.header.frame_id = command.twist_frame_id[i];
+            thrust.thrust = command.thrust[i];
+          });
+      if (controller.node_ptr_->now() > controller.next_deadline_)
+        controller.overrun_count_++;
+    }
+    workspace.locks.clear();
+  }
+
+  void ControllerBase::updateControlDeadline()
+  {
+    const rclcpp::Time now = node_ptr_->now();
+    if (next_deadline_.nanoseconds() == 0 ||
+        now.get_clock_type() != next_deadline_.get_clock_type() ||
+        (next_deadline_ - now) > control_period_)
+    {
+      // first tick, rate change or clock jumped backwards (e.g. sim time reset)
+      next_deadline_ = now + control_period_;
+      return;
+    }
+
+    // next_deadline_ is the scheduled time of this tick, the timer fires it early or late
+    const int64_t lateness_ns = (now - next_deadline_).nanoseconds();
+    loop_stats_.tick_jitter.record(std::abs(lateness_ns));
+
+    // only a tick more than one period late lost the ticks in between
+    const int64_t period_ns = control_period_.nanoseconds();
+    const int64_t missed_ticks = lateness_ns > period_ns ? lateness_ns / period_ns : 0;
+    if (missed_ticks > 0)
+    {
+      missed_tick_count_ += missed_ticks;
+      auto &clock = *node_ptr_->get_clock();
+      RCLCPP_WARN_THROTTLE(node_ptr_->get_logger(), clock, 1000,
+                           "Control loop missed %ld ticks (%lu overruns, %lu missed ticks total)",
+                           static_cast<long>(missed_ticks),
+                           static_cast<unsigned long>(overrun_count_),
+                           static_cast<unsigned long>(missed_tick_count_));
+    }
+
+    // re-anchored on every tick, early or late, on the absolute grid so the loop does not
+    // accumulate drift
+    next_deadline_ = next_deadline_ + control_period_ * static_cast<double>(missed_ticks + 1);
+  }
+
+  void ControllerBase::updateRateBounds(ControllerBase &next)
+  {
+    double min_freq = cmd_freq_, max_freq = cmd_freq_;
+    if (next.getControlRateBounds(min_freq, max_freq))
+    {
+      max_freq = std::clamp(max_freq, 1e-3, cmd_freq_);
+      min_freq = std::clamp(min_freq, 1e-3, max_freq);
+    }
+    else
+    {
+      // no bounds declared, only the fidelity levels are governed
+      min_freq = max_freq = cmd_freq_;
+    }
+    governor_.min_freq = min_freq;
+    governor_.max_freq = max_freq;
+  }
+
+  // Evaluated at the end of every tick, acts once per second of ticks. Steps down as soon as
+  // a window overruns or the plugin uses more than high_load of the period, and steps up only
+  // after a few windows below low_load, so it does not oscillate around the limit
+  void ControllerBase::governRate()
+  {
+    static constexpr int64_t window_ns = 1000000000;
+    static constexpr int calm_windows_to_step_up = 3;
+
+    auto &governor = governor_;
+    const int64_t now_ns = node_ptr_->now().nanoseconds();
+    const uint64_t late_ticks = overrun_count_ + missed_tick_count_;
+    if (governor.window_start_ns == 0 || now_ns < governor.window_start_ns)
+    {
+      governor.window_start_ns = now_ns;
+      governor.window_late_ticks = late_ticks;
+      governor.window_compute_ns = 0;
+      governor.window_ticks = 0;
+      return;
+    }
+    if (now_ns - governor.window_start_ns < window_ns)
+    {
+      return;
+    }
+
+    const bool late = late_ticks > governor.window_late_ticks;
+    const double load =
+        governor.window_ticks > 0
+            ? static_cast<double>(governor.window_compute_ns) /
+                  (static_cast<double>(governor.window_ticks) * control_period_.nanoseconds())
+            : 0.0;
+    governor.window_start_ns = now_ns;
+    governor.window_late_ticks = late_ticks;
+    governor.window_compute_ns = 0;
+    governor.window_ticks = 0;
+
+    const double freq = control_freq_;
+    if (freq > governor.max_freq || freq < governor.min_freq)
+    {
+      // bounds changed with a plugin swap
+      setControlRate(std::clamp(freq, governor.min_freq, governor.max_freq));
+      return;
+    }
+
+    if (late || load > governor.high_load)
+    {
+      governor.calm_windows = 0;
+      // a steady lower rate first, the fidelity is only lowered at the lowest rate
+      if (freq > governor.min_freq)
+      {
+        setControlRate(std::max(freq * governor.step, governor.min_freq));
+      }
+      else if (plugin().setFidelityLevel(governor.fidelity_level + 1))
+      {
+        fidelity_level_ = ++governor.fidelity_level;
+        publishGovernorEvent("Fidelity level lowered");
+      }
+      return;
+    }
+
+    if (load >= governor.low_load || ++governor.calm_windows < calm_windows_to_step_up)
+    {
+      return;
+    }
+    governor.calm_windows = 0;
+    if (governor.fidelity_level > 0)
+    {
+      if (plugin().setFidelityLevel(governor.fidelity_level - 1))
+      {
+        fidelity_level_ = --governor.fidelity_level;
+        publishGovernorEvent("Fidelity level raised");
+      }
+    }
+    else if (freq < governor.max_freq)
+    {
+      setControlRate(std::min(freq / governor.step, governor.max_freq));
+    }
   }
 
-  void ControllerBase::state_callback(const geometry_msgs::msg::PoseStamped::ConstSharedPtr pose_msg,
-                                      const geometry_msgs::msg::TwistStamped::ConstSharedPtr twist_msg)
+  void ControllerBase::setControlRate(const double freq)
   {
-    state_adquired_ = true;
-    pose_ = *pose_msg;
-    twist_ = *twist_msg;
-    if (!bypass_controller_)
-      updateState(pose_, twist_);
+    const bool lowered = freq < control_freq_;
+    control_freq_ = freq;
+    control_period_ = rclcpp::Duration::from_seconds(1.0 / freq);
+    // timers cannot change their period, the new one starts a period from now
+    control_timer_->cancel();
+    control_timer_ = rclcpp::create_timer(node_ptr_, node_ptr_->get_clock(), control_period_,
+                                          std::bind(&ControllerBase::control_timer_callback, this),
+                                          control_callback_group_);
+    next_deadline_ = node_ptr_->now() + control_period_;
+    publishGovernorEvent(lowered ? "Control rate lowered" : "Control rate raised");
   }
 
-  void ControllerBase::ref_pose_callback(const geometry_msgs::msg::PoseStamped::SharedPtr msg)
+  // published right away on the diagnostics topic, next to the periodic control loop status
+  void ControllerBase::publishGovernorEvent(const std::string &message)
   {
-    motion_reference_adquired_ = true;
-    ref_pose_ = *msg;
-    if (!bypass_controller_)
-      updateReference(ref_pose_);
-  }
+    RCLCPP_INFO(node_ptr_->get_logger(), "%s: %.1f Hz, fidelity level %d", message.c_str(),
+                control_freq_.load(), governor_.fidelity_level);
 
-  void ControllerBase::ref_twist_callback(const geometry_msgs::msg::TwistStamped::SharedPtr msg)
-  {
-    motion_reference_adquired_ = true;
-    ref_twist_ = *msg;
-    if (!bypass_controller_)
-      updateReference(ref_twist_);
-  }
+    diagnostic_msgs::msg::DiagnosticStatus status;
+    status.name = std::string(node_ptr_->get_fully_qualified_name()) + ": rate governor";
+    status.hardware_id = node_ptr_->get_namespace();
+    status.level = control_freq_ < cmd_freq_ || governor_.fidelity_level > 0
+                       ? diagnostic_msgs::msg::DiagnosticStatus::WARN
+                       : diagnostic_msgs::msg::DiagnosticStatus::OK;
+    status.message = message;
+    diagnostic_msgs::msg::KeyValue key_value;
+    key_value.key = "control_frequency";
+    key_value.value = std::to_string(control_freq_.load());
+    status.values.push_back(key_value);
+    key_value.key = "fidelity_level";
+    key_value.value = std::to_string(governor_.fidelity_level);
+    status.values.push_back(key_value);
 
-  void ControllerBase::ref_traj_callback(
-      const trajectory_msgs::msg::JointTrajectoryPoint::SharedPtr msg)
-  {
-    motion_reference_adquired_ = true;
-    ref_traj_ = *msg;
-    if (!bypass_controller_)
-      updateReference(ref_traj_);
+    diagnostic_msgs::msg::DiagnosticArray msg;
+    msg.header.stamp = node_ptr_->now();
+    msg.status.push_back(status);
+    diagnostics_pub_->publish(msg);
   }
 
-  void ControllerBase::platform_info_callback(const as2_msgs::msg::PlatformInfo::SharedPtr msg)
+  void ControllerBase::diagnostics_timer_callback()
   {
-    platform_info_ = *msg;
-  }
+    auto &window = loop_stats_window_;
+    const auto state_age = loop_stats_.state_age.summarize(window.state_age);
+    const auto reference_age = loop_stats_.reference_age.summarize(window.reference_age);
+    const auto compute = loop_stats_.compute.summarize(window.compute);
+    const auto publish = loop_stats_.publish.summarize(window.publish);
+    const auto tick_jitter = loop_stats_.tick_jitter.summarize(window.tick_jitter);
 
-  void ControllerBase::control_timer_callback()
-  {
-    if (!platform_info_.offboard || !platform_info_.armed)
+    const uint64_t commands = loop_stats_.commands.load(std::memory_order_relaxed);
+    const uint64_t overruns = overrun_count_.load(std::memory_order_relaxed);
+    const uint64_t missed_ticks = missed_tick_count_.load(std::memory_order_relaxed);
+    const uint64_t window_overruns = overruns - window.overruns;
+    const uint64_t window_missed_ticks = missed_ticks - window.missed_ticks;
+    const uint64_t window_commands = commands - window.commands;
+    window.commands = commands;
+    window.overruns = overruns;
+    window.missed_ticks = missed_ticks;
+
+    diagnostic_msgs::msg::DiagnosticStatus status;
+    status.name = std::string(node_ptr_->get_fully_qualified_name()) + ": control loop";
+    status.hardware_id = node_ptr_->get_namespace();
+    status.level = diagnostic_msgs::msg::DiagnosticStatus::OK;
+    status.message = "OK";
+    const double period_us = 1e6 / control_freq_;
+    if (compute.p99_us > period_us)
     {
-      return;
+      status.level = diagnostic_msgs::msg::DiagnosticStatus::WARN;
+      status.message = "computeOutput over budget";
     }
-
-    if (!control_mode_established_)
+    else if (watchdog_tripped_)
     {
-      return;
+      status.level = diagnostic_msgs::msg::DiagnosticStatus::ERROR;
+      status.message = "Watchdog tripped, inputs stale";
+    }
+    else if (window_overruns > 0 || window_missed_ticks > 0)
+    {
+      status.level = diagnostic_msgs::msg::DiagnosticStatus::WARN;
+      status.message = "Control loop overruns";
     }
 
-    if (!state_adquired_)
+    auto add_value = [&status](const std::string &key, const double value)
     {
-      auto &clock = *node_ptr_->get_clock();
-      RCLCPP_INFO_THROTTLE(node_ptr_->get_logger(), clock, 1000, "Waiting for odometry ");
+      diagnostic_msgs::msg::KeyValue key_value;
+      key_value.key = key;
+      key_value.value = std::to_string(value);
+      status.values.push_back(key_value);
+    };
+    auto add_summary = [&add_value](const std::string &name,
+                                    const LatencyHistogram::Summary &summary)
+    {
+      add_value(name + "_mean_us", summary.mean_us);
+      add_value(name + "_p50_us", summary.p50_us);
+      add_value(name + "_p99_us", summary.p99_us);
+      add_value(name + "_max_us", summary.max_us);
+    };
 
-      return;
+    auto add_mode = [&status](const std::string &key, const as2_msgs::msg::ControlMode &mode)
+    {
+      diagnostic_msgs::msg::KeyValue key_value;
+      key_value.key = key;
+      key_value.value = as2::controlModeToString(mode);
+      status.values.push_back(key_value);
+    };
+    add_mode("input_mode", getMode());
+    add_mode("output_mode", getOutputMode());
+    add_value("bypass", isBypassed());
+    add_value("mode_changed", mode_changed_.exchange(false, std::memory_order_relaxed));
+    add_value("control_frequency", control_freq_);
+    add_value("fidelity_level", fidelity_level_);
+    add_value("commands", window_commands);
+    add_value("overruns", window_overruns);
+    add_value("missed_ticks", window_missed_ticks);
+    add_value("overruns_total", overruns);
+    add_value("watchdog_trips", watchdog_trips_.load(std::memory_order_relaxed));
+    add_summary("state_age", state_age);
+    add_summary("reference_age", reference_age);
+    add_summary("compute", compute);
+    add_summary("publish", publish);
+    add_summary("tick_jitter", tick_jitter);
+    for (auto &stage : plugin().compute_stages_)
+    {
+      const uint64_t stage_overruns = stage->overruns.load(std::memory_order_relaxed);
+      add_value("stage_" + stage->name + "_frequency", stage->freq);
+      add_value("stage_" + stage->name + "_overruns", stage_overruns - stage->window_overruns);
+      add_summary("stage_" + stage->name + "_compute", stage->stats.summarize(stage->stats_window));
+      stage->window_overruns = stage_overruns;
     }
 
-    sendCommand();
-  };
+    diagnostic_msgs::msg::DiagnosticArray msg;
+    msg.header.stamp = node_ptr_->now();
+    msg.status.push_back(status);
+    diagnostics_pub_->publish(msg);
+  }
 
   // TODO: move to ControllerManager?
-  bool ControllerBase::setPlatformControlMode(const as2_msgs::msg::ControlMode &mode)
+  void ControllerBase::setPlatformControlMode(const as2_msgs::msg::ControlMode &mode)
   {
-    as2_msgs::srv::SetControlMode::Request set_control_mode_req;
-    as2_msgs::srv::SetControlMode::Response set_control_mode_resp;
-    set_control_mode_req.control_mode = mode;
-    auto out = set_control_mode_client_->sendRequest(set_control_mode_req, set_control_mode_resp);
-    if (out && set_control_mode_resp.success)
-      return true;
-    return false;
+    if (!set_control_mode_client_->service_is_ready())
+    {
+      RCLCPP_ERROR(node_ptr_->get_logger(), "Platform set control mode service not available");
+      finishModeNegotiation(false);
+      return;
+    }
+
+    auto set_control_mode_req = std::make_shared<as2_msgs::srv::SetControlMode::Request>();
+    set_control_mode_req->control_mode = mode;
+    const uint64_t negotiation_id = negotiation_id_;
+    set_control_mode_client_->async_send_request(
+        set_control_mode_req,
+        [this, negotiation_id](
+            rclcpp::Client<as2_msgs::srv::SetControlMode>::SharedFuture future)
+        {
+          if (negotiation_id != negotiation_id_ ||
+              negotiation_state_ != ModeNegotiationState::SETTING_PLATFORM_MODE)
+          {
+            return;  // negotiation already timed out
+          }
+          if (!future.get()->success)
+          {
+            RCLCPP_ERROR(node_ptr_->get_logger(), "Failed to set platform control mode");
+            finishModeNegotiation(false);
+            return;
+          }
+          applyNegotiatedMode();
+        });
   };
 
-  bool ControllerBase::listPlatformAvailableControlModes()
+  // the platform modes are learned as soon as the platform is up, and again every time it
+  // comes back, so mode requests do not have to wait for them
+  // the graph is only looked at after it changes. The modes are fetched whenever the platform
+  // mode service appears, or is served by a new endpoint, i.e. a restarted or different platform
+  void ControllerBase::platform_discovery_timer_callback()
   {
-    if (platform_available_modes_in_.empty())
+    if (!platform_graph_event_->check_and_clear() && platform_graph_checked_)
+      return;
+    platform_graph_checked_ = true;
+
+    if (!list_control_modes_client_->service_is_ready())
     {
-      RCLCPP_DEBUG(node_ptr_->get_logger(), "LISTING AVAILABLE MODES");
-      // if the list is empty, send a request to the platform to get the list of available modes
-      as2_msgs::srv::ListControlModes::Request list_control_modes_req;
-      as2_msgs::srv::ListControlModes::Response list_control_modes_resp;
+      if (platform_server_found_)
+        RCLCPP_WARN(node_ptr_->get_logger(), "Platform control mode service lost");
+      platform_server_found_ = false;
+      return;
+    }
 
-      bool out =
-          list_control_modes_client_->sendRequest(list_control_modes_req, list_control_modes_resp);
-      if (!out)
-      {
-        RCLCPP_ERROR(node_ptr_->get_logger(), "Error listing control_modes");
-        return false;
-      }
-      if (list_control_modes_resp.control_modes.empty())
-      {
-        RCLCPP_ERROR(node_ptr_->get_logger(), "No available control modes");
-        return false;
-      }
+    // restarts without the service disappearing in between are only seen on middlewares
+    // exposing the server as the reader of its request topic, as DDS does
+    const std::string request_topic =
+        std::string("rq") + list_control_modes_client_->get_service_name() + "Request";
+    const auto servers = node_ptr_->get_subscriptions_info_by_topic(request_topic, true);
+    const bool server_restarted = !servers.empty() &&
+                                  servers.front().endpoint_gid() != platform_server_gid_;
+    if (platform_server_found_ && !server_restarted)
+      return;
+    if (!servers.empty())
+      platform_server_gid_ = servers.front().endpoint_gid();
+    platform_server_found_ = true;
+    RCLCPP_INFO(node_ptr_->get_logger(), "Platform control mode service available");
+    fetchPlatformControlModes();
+  }
 
-      // log the available modes
-      for (auto &mode : list_control_modes_resp.control_modes)
-      {
-        RCLCPP_DEBUG(node_ptr_->get_logger(), "Available mode: %s",
-                     as2::controlModeToString(mode).c_str());
-      }
+  // the modes of the plugin are kept, only the platform side of the table changes
+  void ControllerBase::setPlatformControlModes(const std::vector<uint8_t> &modes)
+  {
+    platform_available_modes_in_ = modes;
+    buildControlModeTable();
+  }
 
-      platform_available_modes_in_ = list_control_modes_resp.control_modes;
-    }
-    return true;
+  void ControllerBase::fetchPlatformControlModes()
+  {
+    auto request = std::make_shared<as2_msgs::srv::ListControlModes::Request>();
+    list_control_modes_client_->async_send_request(
+        request,
+        [this](rclcpp::Client<as2_msgs::srv::ListControlModes>::SharedFuture future)
+        {
+          const auto response = future.valid() ? future.get() : nullptr;
+          if (!response || response->control_modes.empty())
+          {
+            RCLCPP_WARN(node_ptr_->get_logger(), "Platform reported no available control modes");
+            return;
+          }
+          if (response->control_modes == platform_available_modes_in_)
+            return;
+          setPlatformControlModes(response->control_modes);
+          RCLCPP_INFO(node_ptr_->get_logger(), "Platform control modes updated (%zu modes)",
+                      platform_available_modes_in_.size());
+        });
   }
 
-  bool ControllerBase::tryToBypassController(const uint8_t input_mode, uint8_t &output_mode)
+  void ControllerBase::listPlatformAvailableControlModes()
   {
-    // check if platform available modes are set
-    if ((input_mode & MATCH_MODE) == UNSET_MODE_MASK ||
-        (input_mode & MATCH_MODE) == HOVER_MODE_MASK)
+    RCLCPP_DEBUG(node_ptr_->get_logger(), "LISTING AVAILABLE MODES");
+    if (!list_control_modes_client_->service_is_ready())
     {
-      return false;
+      RCLCPP_ERROR(node_ptr_->get_logger(), "Error listing control_modes: service not available");
+      finishModeNegotiation(false);
+      return;
     }
 
-    uint8_t candidate_mode =
-        findBestMatchWithMask(input_mode, platform_available_modes_in_, MATCH_ALL);
-    if (candidate_mode)
-    {
-      output_mode = candidate_mode;
-      return true;
-    }
-    return false;
+    // send a request to the platform to get the list of available modes
+    auto list_control_modes_req = std::make_shared<as2_msgs::srv::ListControlModes::Request>();
+    const uint64_t negotiation_id = negotiation_id_;
+    list_control_modes_client_->async_send_request(
+        list_control_modes_req,
+        [this, negotiation_id](
+            rclcpp::Client<as2_msgs::srv::ListControlModes>::SharedFuture future)
+        {
+          if (negotiation_id != negotiation_id_ ||
+              negotiation_state_ != ModeNegotiationState::LISTING_PLATFORM_MODES)
+          {
+            return;  // negotiation already timed out
+          }
+          auto list_control_modes_resp = future.get();
+          if (list_control_modes_resp->control_modes.empty())
+          {
+            RCLCPP_ERROR(node_ptr_->get_logger(), "No available control modes");
+            finishModeNegotiation(false);
+            return;
+          }
+
+          // log the available modes
+          for (auto &mode : list_control_modes_resp->control_modes)
+          {
+            RCLCPP_DEBUG(node_ptr_->get_logger(), "Available mode: %s",
+                         as2::controlModeToString(mode).c_str());
+          }
+
+          setPlatformControlModes(list_control_modes_resp->control_modes);
+          negotiateOutputMode();
+        });
   }
 
-  bool ControllerBase::checkSuitabilityInputMode(const uint8_t input_mode,
-                                                 const uint8_t output_mode)
+  void ControllerBase::setInputControlModesAvailables(const std::vector<uint8_t> &available_modes)
   {
+    controller_available_modes_in_ = available_modes;
+    // sort modes in ascending order
+    std::sort(controller_available_modes_in_.begin(), controller_available_modes_in_.end());
+    buildControlModeTable();
+  }
+
+  void ControllerBase::setOutputControlModesAvailables(const std::vector<uint8_t> &available_modes)
+  {
+    controller_available_modes_out_ = available_modes;
+    // sort modes in ascending order
+    std::sort(controller_available_modes_out_.begin(), controller_available_modes_out_.end());
+    buildControlModeTable();
+  }
 
-    // check if input_conversion is in the list of available modes
-    bool mode_found = false;
+  bool ControllerBase::checkSuitabilityInputMode(const uint8_t input_mode) const
+  {
     for (auto &mode : controller_available_modes_in_)
     {
       if ((input_mode & MATCH_MODE) == HOVER_MODE_MASK && (input_mode & MATCH_MODE) == mode)
       {
-        mode_found = true;
         return true;
       }
       else if (mode == input_mode)
       {
-        mode_found = true;
-        break;
+        return true;
       }
     }
+    return false;
+  }
 
-    // check if the input mode is compatible with the output mode
-    if ((input_mode & MATCH_MODE) < (output_mode & 0b1111000))
+  void ControllerBase::buildControlModeTable()
+  {
+    control_mode_table_ready_ = false;
+    if (platform_available_modes_in_.empty())
     {
-      RCLCPP_ERROR(node_ptr_->get_logger(),
-                   "Input control mode has lower level than output control mode");
-      return false;
+      return;
     }
 
-    return mode_found;
-  }
+    std::bitset<256> platform_modes;
+    for (auto &mode : platform_available_modes_in_)
+    {
+      platform_modes.set(mode);
+    }
 
-  bool ControllerBase::findSuitableOutputControlModeForPlatformInputMode(uint8_t &output_mode,
-                                                                         const uint8_t input_mode)
-  {
-    //  check if the prefered mode is available
-    if (prefered_output_mode_)
+    // controller outputs accepted by the platform, in ascending priority order
+    std::vector<uint8_t> common_output_modes;
+    for (auto &mode_out : controller_available_modes_out_)
     {
-      auto match =
-          findBestMatchWithMask(prefered_output_mode_, platform_available_modes_in_, MATCH_ALL);
-      if (match)
+      if (isControllableMode(mode_out) && platform_modes.test(mode_out))
       {
-        output_mode = match;
-        return true;
+        common_output_modes.push_back(mode_out);
       }
     }
 
-    // if the prefered mode is not available, search for the first common mode
+    for (size_t input_mode = 0; input_mode < control_mode_table_.size(); input_mode++)
+    {
+      auto &row = control_mode_table_[input_mode];
+      auto &decision = control_mode_decisions_[input_mode];
+      row.reset();
+      decision = ControlModeDecision();
+      const uint8_t mode_in = static_cast<uint8_t>(input_mode);
 
-    uint8_t common_mode = 0;
-    bool same_yaw = false;
+      // 1st: bypass, the platform accepts the input mode as it is
+      const bool bypass = use_bypass_ && isControllableMode(mode_in) && platform_modes.test(mode_in);
+      if (bypass)
+      {
+        row.set(mode_in);
+        decision = {mode_in, true, true};
+      }
 
-    for (auto &mode_out : controller_available_modes_out_)
-    {
-      // skip unset modes and hover
-      if ((mode_out & MATCH_MODE) == UNSET_MODE_MASK || (mode_out & MATCH_MODE) == HOVER_MODE_MASK)
+      if (!checkSuitabilityInputMode(mode_in))
+      {
+        continue;
+      }
+
+      // hover is always accepted, otherwise the input must not be lower level than the output
+      const bool is_hover = (mode_in & MATCH_MODE) == HOVER_MODE_MASK;
+      auto level_ok = [is_hover, mode_in](const uint8_t mode_out)
+      { return is_hover || (mode_in & MATCH_MODE) >= (mode_out & MATCH_MODE); };
+
+      for (auto &mode_out : common_output_modes)
+      {
+        if (level_ok(mode_out))
+        {
+          row.set(mode_out);
+        }
+      }
+
+      if (decision.feasible)
+      {
+        continue;
+      }
+
+      // 2nd: the prefered output mode, 3rd: the first common output mode
+      if (prefered_output_mode_ && platform_modes.test(prefered_output_mode_) &&
+          level_ok(prefered_output_mode_))
       {
+        decision = {prefered_output_mode_, true, false};
         continue;
       }
-      common_mode = findBestMatchWithMask(mode_out, platform_available_modes_in_, MATCH_ALL);
+      for (auto &mode_out : common_output_modes)
+      {
+        if (row.test(mode_out))
+        {
+          decision = {mode_out, true, false};
+          break;
+        }
+      }
     }
+    control_mode_table_ready_ = true;
+  }
 
-    // check if the common mode exist
-    if (common_mode == 0)
+  void ControllerBase::listCompatibleControlModesSrvCall(
+      const as2_msgs::srv::ListControlModes::Request::SharedPtr request,
+      as2_msgs::srv::ListControlModes::Response::SharedPtr response)
+  {
+    // flattened (input_mode, output_mode) pairs, bypass pairs have input_mode == output_mode
+    response->control_modes.clear();
+    if (!control_mode_table_ready_)
     {
-      return false;
+      RCLCPP_WARN(node_ptr_->get_logger(), "Platform control modes not known yet");
+      return;
+    }
+    for (size_t input_mode = 0; input_mode < control_mode_table_.size(); input_mode++)
+    {
+      const auto &row = control_mode_table_[input_mode];
+      if (row.none())
+      {
+        continue;
+      }
+      for (size_t output_mode = 0; output_mode < row.size(); output_mode++)
+      {
+        if (row.test(output_mode))
+        {
+          response->control_modes.push_back(static_cast<uint8_t>(input_mode));
+          response->control_modes.push_back(static_cast<uint8_t>(output_mode));
+        }
+      }
     }
-    output_mode = common_mode;
-    return true;
   }
 
   void ControllerBase::setControlModeSrvCall(
-      const as2_msgs::srv::SetControlMode::Request::SharedPtr request,
-      as2_msgs::srv::SetControlMode::Response::SharedPtr response)
+      const std::shared_ptr<rmw_request_id_t> request_header,
+      const as2_msgs::srv::SetControlMode::Request::SharedPtr request)
   {
-    control_mode_established_ = false;
+    if (negotiation_state_ != ModeNegotiationState::IDLE)
+    {
+      RCLCPP_WARN(node_ptr_->get_logger(), "Control mode negotiation already in progress");
+      as2_msgs::srv::SetControlMode::Response response;
+      response.success = false;
+      set_control_mode_srv_->send_response(*request_header, response);
+      return;
+    }
+
+    // the previous mode keeps being commanded until the platform confirms the new one
+    negotiation_id_++;
+    negotiation_.request_header = request_header;
+    negotiation_.requested_mode = request->control_mode;
     // input_control_mode_desired
-    uint8_t input_control_mode_desired = 0;
     if (request->control_mode.control_mode == as2_msgs::msg::ControlMode::HOVER)
     {
-      input_control_mode_desired = HOVER_MODE_MASK;
+      negotiation_.input_mode_desired = HOVER_MODE_MASK;
     }
     else
     {
-      input_control_mode_desired = as2::convertAS2ControlModeToUint8t(request->control_mode);
+      negotiation_.input_mode_desired = as2::convertAS2ControlModeToUint8t(request->control_mode);
     }
+    CONTROLLER_TRACEPOINT(mode_negotiation, this, negotiation_id_, tracing::REQUESTED,
+                          negotiation_.input_mode_desired, 0, 0);
+
+    const uint64_t negotiation_id = negotiation_id_;
+    negotiation_timeout_timer_ = node_ptr_->create_wall_timer(
+        std::chrono::duration<double>(mode_negotiation_timeout_),
+        [this, negotiation_id]()
+        {
+          if (negotiation_id != negotiation_id_ ||
+              negotiation_state_ == ModeNegotiationState::IDLE)
+          {
+            return;
+          }
+          RCLCPP_ERROR(node_ptr_->get_logger(), "Control mode negotiation timed out");
+          set_control_mode_client_->prune_pending_requests();
+          list_control_modes_client_->prune_pending_requests();
+          finishModeNegotiation(false);
+        },
+        service_callback_group_);
 
     // check if platform_available_modes is set
-    if (!listPlatformAvailableControlModes())
+    if (platform_available_modes_in_.empty())
     {
-      response->success = false;
+      negotiation_state_ = ModeNegotiationState::LISTING_PLATFORM_MODES;
+      CONTROLLER_TRACEPOINT(mode_negotiation, this, negotiation_id_, tracing::LISTING_PLATFORM_MODES,
+                            negotiation_.input_mode_desired, 0, 0);
+      listPlatformAvailableControlModes();
       return;
     }
+    negotiateOutputMode();
+  }
 
-    // 1st: check if a bypass is possible for the input_control_mode_desired ( DISCARDING YAW
-    // COMPONENT)
-
-    uint8_t output_control_mode_candidate = 0;
-
-    if (use_bypass_)
-    {
-      bypass_controller_ =
-        tryToBypassController(input_control_mode_desired, output_control_mode_candidate);
-    }
-    else
-    {
-      bypass_controller_ = false;
-    }
+  void ControllerBase::negotiateOutputMode()
+  {
+    const uint8_t input_control_mode_desired = negotiation_.input_mode_desired;
 
-    if (!bypass_controller_)
+    // the decision was precomputed when the available modes were learned
+    const auto &decision = control_mode_decisions_[input_control_mode_desired];
+    if (!decision.feasible)
     {
-      bool success = findSuitableOutputControlModeForPlatformInputMode(output_control_mode_candidate,
-                                                                       input_control_mode_desired);
-      if (!success)
-      {
-        RCLCPP_WARN(node_ptr_->get_logger(), "No suitable output control mode found");
-        response->success = false;
-        return;
-      }
-
-      success = checkSuitabilityInputMode(input_control_mode_desired, output_control_mode_candidate);
-      if (!success)
+      if (!checkSuitabilityInputMode(input_control_mode_desired))
       {
         RCLCPP_ERROR(node_ptr_->get_logger(),
                      "Input control mode is not suitable for this controller");
-        response->success = false;
-        return;
       }
+      else
+      {
+        RCLCPP_WARN(node_ptr_->get_logger(), "No suitable output control mode found");
+      }
+      finishModeNegotiation(false);
+      return;
     }
+    negotiation_.bypass = decision.bypass;
+    const uint8_t output_control_mode_candidate = decision.output_mode;
 
     // request the common mode to the platform
-    auto mode_to_request = as2::convertUint8tToAS2ControlMode(output_control_mode_candidate);
-    if (!setPlatformControlMode(mode_to_request))
+    negotiation_.mode_to_request = as2::convertUint8tToAS2ControlMode(output_control_mode_candidate);
+    negotiation_state_ = ModeNegotiationState::SETTING_PLATFORM_MODE;
+    CONTROLLER_TRACEPOINT(mode_negotiation, this, negotiation_id_, tracing::SETTING_PLATFORM_MODE,
+                          negotiation_.input_mode_desired, output_control_mode_candidate, 0);
+    setPlatformControlMode(negotiation_.mode_to_request);
+  }
+
+  void ControllerBase::applyNegotiatedMode()
+  {
+    bool success = false;
     {
-      RCLCPP_ERROR(node_ptr_->get_logger(), "Failed to set platform control mode");
-      response->success = false;
-      return;
-    }
+      // swap to the new mode at a tick boundary
+      std::lock_guard<std::mutex> mode_lock(mode_mutex_);
+      // stages resume after the first tick in the new mode
+      const auto stage_locks = plugin().lockComputeStages();
+      plugin().stages_active_ = false;
+      ModeHandoff handoff;
+      handoff.previous_input_mode = input_mode_;
+      handoff.previous_output_mode = output_mode_;
+      handoff.previous_bypass = bypass_controller_ && control_mode_established_;
+      input_mode_ = negotiation_.requested_mode;
+      reference_topics_ = 0;
+      output_mode_ = negotiation_.mode_to_request;
+      bypass_controller_ = negotiation_.bypass;
+      publish_mask_ = computePublishMask(output_mode_);
 
-    input_mode_ = request->control_mode;
-    output_mode_ = mode_to_request;
+      if (bypass_controller_)
+      {
+        auto unset_mode = as2::convertUint8tToAS2ControlMode(UNSET_MODE_MASK);
+        success = plugin().setMode(unset_mode, unset_mode);
+      }
+      else
+      {
+        success = plugin().setMode(input_mode_, output_mode_);
+        // the state is kept, references of the previous mode are not tracked by the watchdog
+        motion_reference_adquired_ = false;
+        if (success)
+          handOffMode(handoff);
+      }
+      control_mode_established_ = success;
+      forward_on_reference_ = success && bypass_controller_;
+      mode_snapshot_.store(static_cast<uint32_t>(as2::convertAS2ControlModeToUint8t(input_mode_)) |
+                               static_cast<uint32_t>(as2::convertAS2ControlModeToUint8t(output_mode_)) << 8 |
+                               static_cast<uint32_t>(bypass_controller_) << 16,
+                           std::memory_order_release);
+      if (flight_recorder_)
+        recordMode(success);
+    }
 
     if (bypass_controller_)
     {
       RCLCPP_INFO(node_ptr_->get_logger(), "Bypassing controller:");
-      RCLCPP_INFO(node_ptr_->get_logger(), "input_mode:[%s]",
-                  as2::controlModeToString(input_mode_).c_str());
-      RCLCPP_INFO(node_ptr_->get_logger(), "output_mode:[%s]",
-                  as2::controlModeToString(output_mode_).c_str());
-      as2::printControlMode(output_mode_);
-      auto unset_mode = as2::convertUint8tToAS2ControlMode(UNSET_MODE_MASK);
-      response->success = setMode(unset_mode, unset_mode);
-      control_mode_established_ = response->success;
-      return;
     }
-
     RCLCPP_INFO(node_ptr_->get_logger(), "input_mode:[%s]",
                 as2::controlModeToString(input_mode_).c_str());
     RCLCPP_INFO(node_ptr_->get_logger(), "output_mode:[%s]",
                 as2::controlModeToString(output_mode_).c_str());
+    if (bypass_controller_)
+    {
+      as2::printControlMode(output_mode_);
+    }
 
-    response->success = setMode(input_mode_, output_mode_);
-    control_mode_established_ = response->success;
-
-    if (!response->success)
+    if (!success)
     {
       RCLCPP_ERROR(node_ptr_->get_logger(), "Failed to set control mode in the controller");
     }
-    state_adquired_ = false;
-    motion_reference_adquired_ = false;
-    return;
+    finishModeNegotiation(success);
+
+    if (success)
+    {
+      // reported by the next diagnostics, publishing them now would cut their window short
+      mode_changed_.store(true, std::memory_order_relaxed);
+      if (mode_change_callback_)
+        mode_change_callback_();
+    }
+  }
+
+  // bumpless switch: the plugin gets the state the tick would use right away and the commands
+  // it takes over
+  void ControllerBase::handOffMode(const ModeHandoff &previous)
+  {
+    ModeHandoff handoff = previous;
+    const auto &state = state_buffer_.read();
+    if (state_adquired_ && state.pose && state.twist)
+    {
+      if (interpolate_state_)
+      {
+        // bypassed ticks do not interpolate, so it is estimated now as the next tick would
+        interpolateState(node_ptr_->now());
+        handoff.pose = &interpolated_pose_;
+        handoff.twist = &interpolated_twist_;
+      }
+      else
+      {
+        handoff.pose = state.pose.get();
+        handoff.twist = state.twist.get();
+      }
+      plugin().updateState(*handoff.pose, *handoff.twist);
+    }
+    if (command_sent_ && handoff.previous_bypass)
+    {
+      // the forwarded references were the commands
+      handoff.command_pose = ref_pose_buffer_.read().get();
+      handoff.command_twist = ref_twist_buffer_.read().get();
+      handoff.command_thrust = ref_thrust_buffer_.read().get();
+    }
+    else if (command_sent_)
+    {
+      handoff.command_pose = &command_pose_;
+      handoff.command_twist = &command_twist_;
+      handoff.command_thrust = &command_thrust_;
+    }
+    plugin().onModeHandoff(handoff);
+  }
+
+  void ControllerBase::finishModeNegotiation(const bool success)
+  {
+    if (negotiation_timeout_timer_)
+    {
+      negotiation_timeout_timer_->cancel();
+    }
+    negotiation_state_ = ModeNegotiationState::IDLE;
+    CONTROLLER_TRACEPOINT(mode_negotiation, this, negotiation_id_, tracing::FINISHED,
+                          negotiation_.input_mode_desired,
+                          as2::convertAS2ControlModeToUint8t(negotiation_.mode_to_request), success);
+
+    as2_msgs::srv::SetControlMode::Response response;
+    response.success = success;
+    set_control_mode_srv_->send_response(*negotiation_.request_header, response);
+    negotiation_.request_header.reset();
+  }
+
+  uint8_t ControllerBase::computePublishMask(const as2_msgs::msg::ControlMode &mode)
+  {
+    const bool yaw_speed = mode.yaw_mode == as2_msgs::msg::ControlMode::YAW_SPEED;
+    switch (mode.control_mode)
+    {
+    case as2_msgs::msg::ControlMode::POSITION:
+      return POSE_COMMAND | (yaw_speed ? TWIST_COMMAND : 0);
+    case as2_msgs::msg::ControlMode::SPEED:
+      return TWIST_COMMAND | (yaw_speed ? 0 : POSE_COMMAND);
+    case as2_msgs::msg::ControlMode::SPEED_IN_A_PLANE:
+    case as2_msgs::msg::ControlMode::TRAJECTORY:
+      return POSE_COMMAND | TWIST_COMMAND;
+    case as2_msgs::msg::ControlMode::ATTITUDE:
+      return POSE_COMMAND | THRUST_COMMAND | (yaw_speed ? TWIST_COMMAND : 0);
+    case as2_msgs::msg::ControlMode::ACRO:
+      return TWIST_COMMAND | THRUST_COMMAND;
+    default:
+      return POSE_COMMAND | TWIST_COMMAND | THRUST_COMMAND;
+    }
   }
 
   void ControllerBase::sendCommand()
@@ -439,23 +2254,229 @@ namespace controller_plugin_base
 
         return;
       }
-      pose_pub_->publish(ref_pose_);
-      twist_pub_->publish(ref_twist_);
+      forwardReferences();
       return;
     }
-    geometry_msgs::msg::PoseStamped pose;
-    geometry_msgs::msg::TwistStamped twist;
-    as2_msgs::msg::Thrust thrust;
-    computeOutput(pose, twist, thrust);
+
+    publishCommand(
+        [this](geometry_msgs::msg::PoseStamped &pose, geometry_msgs::msg::TwistStamped &twist,
+               as2_msgs::msg::Thrust &thrust)
+        {
+          CONTROLLER_TRACEPOINT(compute_output_start, this,
+                                tracing::stampNs(state_buffer_.read().pose->header.stamp));
+          const auto compute_start = std::chrono::steady_clock::now();
+          plugin().dispatchCompute(pose, twist, thrust);
+          CONTROLLER_TRACEPOINT(compute_output_end, this,
+                                tracing::stampNs(state_buffer_.read().pose->header.stamp));
+          const int64_t compute_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                         std::chrono::steady_clock::now() - compute_start)
+                                         .count();
+          loop_stats_.compute.record(compute_ns);
+          governor_.window_compute_ns += compute_ns;
+          governor_.window_ticks++;
+        });
+  };
+
+  // bypass: every reference is forwarded once, on the topic of the output mode. With a keep
+  // alive rate the last ones are republished, restamped, when nothing new arrived meanwhile
+  void ControllerBase::forwardReferences()
+  {
+    const rclcpp::Time now = node_ptr_->now();
+    const int64_t now_ns = now.nanoseconds();
+    const bool keep_alive_due =
+        bypass_keep_alive_ns_ > 0 && now_ns - last_forward_ns_ >= bypass_keep_alive_ns_;
+
+    const auto &ref_pose = ref_pose_buffer_.read();
+    const auto &ref_twist = ref_twist_buffer_.read();
+    const auto &ref_thrust = ref_thrust_buffer_.read();
+    uint8_t mask = 0;
+    if (ref_pose && (ref_pose_fresh_ || keep_alive_due))
+      mask |= POSE_COMMAND;
+    if (ref_twist && (ref_twist_fresh_ || keep_alive_due))
+      mask |= TWIST_COMMAND;
+    if (ref_thrust && (ref_thrust_fresh_ || keep_alive_due))
+      mask |= THRUST_COMMAND;
+    mask &= publish_mask_;
+    if (mask == 0)
+      return;
+    last_forward_ns_ = now_ns;
+    command_sent_ = true;
+    if (flight_recorder_)
+      recordMessages(recorder::COMMAND, (mask & POSE_COMMAND) ? ref_pose.get() : nullptr,
+                     (mask & TWIST_COMMAND) ? ref_twist.get() : nullptr,
+                     (mask & THRUST_COMMAND) ? ref_thrust.get() : nullptr, mask);
+
+    if (shm_transport_)
+    {
+      writeSharedMemoryCommand(mask, ref_pose ? *ref_pose : command_pose_,
+                               ref_twist ? *ref_twist : command_twist_,
+                               ref_thrust ? *ref_thrust : command_thrust_);
+      CONTROLLER_TRACEPOINT(command_publish, this, mask, now_ns, 0);
+      return;
+    }
+    if (mask & POSE_COMMAND)
+    {
+      if (ref_pose_fresh_)
+        pose_pub_->publish(*ref_pose);
+      else
+      {
+        command_pose_ = *ref_pose;
+        command_pose_.header.stamp = now;
+        pose_pub_->publish(command_pose_);
+      }
+      CONTROLLER_TRACEPOINT(command_publish, this, tracing::POSE,
+                            ref_pose_fresh_ ? tracing::stampNs(ref_pose->header.stamp) : now_ns, 0);
+    }
+    if (mask & TWIST_COMMAND)
+    {
+      if (ref_twist_fresh_)
+        twist_pub_->publish(*ref_twist);
+      else
+      {
+        command_twist_ = *ref_twist;
+        command_twist_.header.stamp = now;
+        twist_pub_->publish(command_twist_);
+      }
+      CONTROLLER_TRACEPOINT(command_publish, this, tracing::TWIST,
+                            ref_twist_fresh_ ? tracing::stampNs(ref_twist->header.stamp) : now_ns, 0);
+    }
+    if (mask & THRUST_COMMAND)
+    {
+      if (ref_thrust_fresh_)
+        thrust_pub_->publish(*ref_thrust);
+      else
+      {
+        command_thrust_ = *ref_thrust;
+        command_thrust_.header.stamp = now;
+        thrust_pub_->publish(command_thrust_);
+      }
+      CONTROLLER_TRACEPOINT(command_publish, this, tracing::THRUST,
+                            ref_thrust_fresh_ ? tracing::stampNs(ref_thrust->header.stamp) : now_ns, 0);
+    }
+  }
+
+  // references are forwarded as soon as they arrive, the control loop only keeps them alive
+  void ControllerBase::referenceEventTick()
+  {
+    std::lock_guard<std::mutex> mode_lock(mode_mutex_);
+    if (bypass_controller_ && prepareTick())
+      sendCommand();
+  }
+
+  template <typename ComputeT>
+  void ControllerBase::publishCommand(ComputeT &&compute)
+  {
+    // loan the messages of the published topics when the middleware supports it. With
+    // intra-process communication they are taken from the pools and handed over as unique_ptr,
+    // otherwise compute on the preallocated ones. Loaned and pooled messages are fresh, the
+    // plugin writes the command straight into them
+    std::optional<PooledLoan<geometry_msgs::msg::PoseStamped>> pose_loan;
+    std::optional<PooledLoan<geometry_msgs::msg::TwistStamped>> twist_loan;
+    std::optional<PooledLoan<as2_msgs::msg::Thrust>> thrust_loan;
+    PooledMessage<geometry_msgs::msg::PoseStamped> pose_unique;
+    PooledMessage<geometry_msgs::msg::TwistStamped> twist_unique;
+    PooledMessage<as2_msgs::msg::Thrust> thrust_unique;
+    // the shared memory transport copies the preallocated messages into the ring
+    const bool use_ros = !shm_transport_;
+    if (use_ros && (publish_mask_ & POSE_COMMAND))
+    {
+      if (pose_pub_->can_loan_messages())
+        pose_loan.emplace(pose_pub_->borrow_loaned_message());
+      else if (use_intra_process_)
+        pose_unique = makePooledMessage(pose_allocator_);
+    }
+    if (use_ros && (publish_mask_ & TWIST_COMMAND))
+    {
+      if (twist_pub_->can_loan_messages())
+        twist_loan.emplace(twist_pub_->borrow_loaned_message());
+      else if (use_intra_process_)
+        twist_unique = makePooledMessage(twist_allocator_);
+    }
+    if (use_ros && (publish_mask_ & THRUST_COMMAND))
+    {
+      if (thrust_pub_->can_loan_messages())
+        thrust_loan.emplace(thrust_pub_->borrow_loaned_message());
+      else if (use_intra_process_)
+        thrust_unique = makePooledMessage(thrust_allocator_);
+    }
+
+    geometry_msgs::msg::PoseStamped &pose =
+        pose_loan ? pose_loan->get() : (pose_unique ? *pose_unique : command_pose_);
+    geometry_msgs::msg::TwistStamped &twist =
+        twist_loan ? twist_loan->get() : (twist_unique ? *twist_unique : command_twist_);
+    as2_msgs::msg::Thrust &thrust =
+        thrust_loan ? thrust_loan->get() : (thrust_unique ? *thrust_unique : command_thrust_);
+    compute(pose, twist, thrust);
+    const auto compute_end = std::chrono::steady_clock::now();
 
     // set time stamp
-    pose.header.stamp = node_ptr_->now();
-    twist.header.stamp = pose.header.stamp;
-    thrust.header = pose.header;
+    const rclcpp::Time stamp = node_ptr_->now();
+    pose.header.stamp = stamp;
+    twist.header.stamp = stamp;
+    thrust.header.stamp = stamp;
+    thrust.header.frame_id = pose.header.frame_id;
+
+    const rclcpp::Time state_stamp(state_buffer_.read().pose->header.stamp);
+    if (state_stamp.nanoseconds() > 0)
+      loop_stats_.state_age.record((stamp - state_stamp).nanoseconds());
+    if (last_reference_stamp_.nanoseconds() > 0)
+      loop_stats_.reference_age.record((stamp - last_reference_stamp_).nanoseconds());
+
+    if (flight_recorder_)
+      recordMessages(recorder::COMMAND, &pose, &twist, &thrust, publish_mask_);
+    // loaned and pooled messages are handed over, the last command is kept for mode hand-offs
+    if (&pose != &command_pose_)
+      command_pose_ = pose;
+    if (&twist != &command_twist_)
+      command_twist_ = twist;
+    if (&thrust != &command_thrust_)
+      command_thrust_ = thrust;
+    command_sent_ = true;
+
+    // only the topics used by the platform output mode are published
+    if (!use_ros)
+    {
+      writeSharedMemoryCommand(publish_mask_, pose, twist, thrust);
+      CONTROLLER_TRACEPOINT(command_publish, this, publish_mask_, stamp.nanoseconds(),
+                            state_stamp.nanoseconds());
+    }
+    else
+    {
+      if (pose_loan)
+        pose_pub_->publish(std::move(*pose_loan));
+      else if (pose_unique)
+        pose_pub_->publish(std::move(pose_unique));
+      else if (publish_mask_ & POSE_COMMAND)
+        pose_pub_->publish(pose);
+      if (publish_mask_ & POSE_COMMAND)
+        CONTROLLER_TRACEPOINT(command_publish, this, tracing::POSE, stamp.nanoseconds(),
+                              state_stamp.nanoseconds());
+
+      if (twist_loan)
+        twist_pub_->publish(std::move(*twist_loan));
+      else if (twist_unique)
+        twist_pub_->publish(std::move(twist_unique));
+      else if (publish_mask_ & TWIST_COMMAND)
+        twist_pub_->publish(twist);
+      if (publish_mask_ & TWIST_COMMAND)
+        CONTROLLER_TRACEPOINT(command_publish, this, tracing::TWIST, stamp.nanoseconds(),
+                              state_stamp.nanoseconds());
+
+      if (thrust_loan)
+        thrust_pub_->publish(std::move(*thrust_loan));
+      else if (thrust_unique)
+        thrust_pub_->publish(std::move(thrust_unique));
+      else if (publish_mask_ & THRUST_COMMAND)
+        thrust_pub_->publish(thrust);
+      if (publish_mask_ & THRUST_COMMAND)
+        CONTROLLER_TRACEPOINT(command_publish, this, tracing::THRUST, stamp.nanoseconds(),
+                              state_stamp.nanoseconds());
+    }
 
-    pose_pub_->publish(pose);
-    twist_pub_->publish(twist);
-    thrust_pub_->publish(thrust);
+    loop_stats_.publish.record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                   std::chrono::steady_clock::now() - compute_end)
+                                   .count());
+    loop_stats_.commands.fetch_add(1, std::memory_order_relaxed);
   };
 
 } // namespace controller_plugin_base
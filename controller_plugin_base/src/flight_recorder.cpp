@@ -0,0 +1,156 @@
+/********************************************************************************************
+ *  \file       flight_recorder.cpp
+ *  \brief      Memory mapped flight recorder file and dumps
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#include "controller_plugin_base/flight_recorder.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+
+namespace controller_plugin_base {
+namespace recorder {
+
+FlightRecorder::~FlightRecorder() {
+  if (addr_) {
+    msync(addr_, size_, MS_SYNC);
+    munmap(addr_, size_);
+  }
+}
+
+bool FlightRecorder::open(const std::string& path, const size_t capacity, std::string& error) {
+  if (capacity == 0) {
+    error = "flight recorder capacity must be positive";
+    return false;
+  }
+  // the recording of the previous run survives one restart, e.g. after a crash
+  struct stat info;
+  if (stat(path.c_str(), &info) == 0 && info.st_size > 0) {
+    std::rename(path.c_str(), (path + ".prev").c_str());
+  }
+
+  const size_t size = sizeof(Header) + capacity * sizeof(Slot);
+  const int fd      = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    error = "open " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  // zero filled, so every sequence and the write count start at zero
+  if (ftruncate(fd, size) != 0) {
+    error = "sizing " + path + ": " + std::strerror(errno);
+    close(fd);
+    return false;
+  }
+  void* addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    error = "mmap " + path + ": " + std::strerror(errno);
+    return false;
+  }
+  // keep the pages resident, writers must not fault on them
+  mlock(addr, size);
+
+  path_     = path;
+  addr_     = addr;
+  size_     = size;
+  capacity_ = capacity;
+  header_   = static_cast<Header*>(addr);
+  slots_    = reinterpret_cast<Slot*>(static_cast<char*>(addr) + sizeof(Header));
+
+  header_->version     = VERSION;
+  header_->record_size = sizeof(Record);
+  header_->capacity    = static_cast<uint32_t>(capacity);
+  std::atomic_thread_fence(std::memory_order_release);
+  header_->magic = MAGIC;
+  return true;
+}
+
+void FlightRecorder::flush() { msync(addr_, size_, MS_ASYNC); }
+
+bool FlightRecorder::dump(const std::string& path, std::string& error) const {
+  std::ofstream file(path, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    error = "open " + path + ": " + std::strerror(errno);
+    return false;
+  }
+
+  // header first, its count is only known once the records are copied
+  Header header;
+  header.magic       = MAGIC;
+  header.version     = VERSION;
+  header.record_size = sizeof(Record);
+  header.capacity    = 0;
+  header.write_count.store(0, std::memory_order_relaxed);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+
+  const uint64_t count = header_->write_count.load(std::memory_order_acquire);
+  const uint64_t first = count > capacity_ ? count - capacity_ : 0;
+  uint64_t copied      = 0;
+  Slot copy;
+  for (uint64_t index = first; index < count; index++) {
+    const Slot& slot        = slots_[index % capacity_];
+    const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+    if (sequence != 2 * index + 2) {
+      continue;  // still being written, or already overwritten
+    }
+    std::memcpy(&copy.record, &slot.record, sizeof(Record));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.sequence.load(std::memory_order_relaxed) != sequence) {
+      continue;
+    }
+    copy.sequence.store(2 * copied + 2, std::memory_order_relaxed);
+    file.write(reinterpret_cast<const char*>(&copy), sizeof(Slot));
+    copied++;
+  }
+
+  header.capacity = static_cast<uint32_t>(copied);
+  header.write_count.store(copied, std::memory_order_relaxed);
+  file.seekp(0);
+  file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+  file.close();
+  if (!file) {
+    error = "writing " + path + " failed";
+    return false;
+  }
+  return true;
+}
+
+}  // namespace recorder
+}  // namespace controller_plugin_base
@@ -0,0 +1,122 @@
+/********************************************************************************************
+ *  \file       shm_transport.cpp
+ *  \brief      Shared memory transport segments
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#include "controller_plugin_base/shm_transport.hpp"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <thread>
+
+namespace controller_plugin_base {
+namespace shm {
+
+Transport::~Transport() {
+  if (state_) munmap(state_, sizeof(StateRing));
+  if (command_) munmap(command_, sizeof(CommandRing));
+}
+
+std::string Transport::segmentName(const std::string& name_space, const std::string& channel) {
+  std::string name = "/as2" + name_space;
+  std::replace(name.begin() + 1, name.end(), '/', '_');
+  return name + "_" + channel;
+}
+
+bool Transport::open(const std::string& name_space, std::string& error) {
+  state_   = map<StateRing>(segmentName(name_space, "state"), error);
+  command_ = state_ ? map<CommandRing>(segmentName(name_space, "command"), error) : nullptr;
+  return state_ && command_;
+}
+
+template <typename RingT>
+RingT* Transport::map(const std::string& name, std::string& error) {
+  const int fd = shm_open(name.c_str(), O_RDWR | O_CREAT, 0660);
+  if (fd < 0) {
+    error = "shm_open " + name + ": " + std::strerror(errno);
+    return nullptr;
+  }
+  // a new segment is zero filled, an existing one keeps its size and contents
+  struct stat info;
+  if (fstat(fd, &info) != 0 ||
+      (info.st_size == 0 && ftruncate(fd, sizeof(RingT)) != 0)) {
+    error = "sizing " + name + ": " + std::strerror(errno);
+    close(fd);
+    return nullptr;
+  }
+  if (info.st_size != 0 && static_cast<size_t>(info.st_size) != sizeof(RingT)) {
+    error = name + " has another layout (size " + std::to_string(info.st_size) + ")";
+    close(fd);
+    return nullptr;
+  }
+  void* addr = mmap(nullptr, sizeof(RingT), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    error = "mmap " + name + ": " + std::strerror(errno);
+    return nullptr;
+  }
+  // keep the pages resident, the control loop must not fault on them
+  mlock(addr, sizeof(RingT));
+
+  auto* ring = static_cast<RingT*>(addr);
+  uint32_t expected = 0;
+  if (ring->magic.compare_exchange_strong(expected, 1)) {
+    // first user: counters and sequences are already zero
+    ring->version     = VERSION;
+    ring->sample_size = sizeof(ring->slots[0].sample);
+    ring->ring_size   = RING_SIZE;
+    ring->magic.store(MAGIC, std::memory_order_release);
+  } else {
+    // wait for the other side to finish the header
+    for (int i = 0; i < 1000 && ring->magic.load(std::memory_order_acquire) != MAGIC; i++) {
+      std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+  }
+  if (ring->magic.load(std::memory_order_acquire) != MAGIC || ring->version != VERSION ||
+      ring->sample_size != sizeof(ring->slots[0].sample) || ring->ring_size != RING_SIZE) {
+    error = name + " has another layout version";
+    munmap(addr, sizeof(RingT));
+    return nullptr;
+  }
+  return ring;
+}
+
+}  // namespace shm
+}  // namespace controller_plugin_base
@@ -0,0 +1,330 @@
+/********************************************************************************************
+ *  \file       allocation_test.cpp
+ *  \brief      Checks that the control loop does not allocate heap memory once initialized
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#include <dlfcn.h>
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <thread>
+
+#include "controller_test_utils.hpp"
+
+// Every heap allocation of the process goes through the malloc family below, whoever makes
+// it: operator new, the middleware or the C libraries. Only the threads that run the control
+// tick count them, the other middleware threads are ignored
+static thread_local bool count_allocations = false;
+static std::atomic<size_t> allocation_count{0};
+
+namespace {
+
+using MallocFn        = void* (*)(size_t);
+using CallocFn        = void* (*)(size_t, size_t);
+using ReallocFn       = void* (*)(void*, size_t);
+using FreeFn          = void (*)(void*);
+using AlignedAllocFn  = void* (*)(size_t, size_t);
+using PosixMemalignFn = int (*)(void**, size_t, size_t);
+
+MallocFn real_malloc                = nullptr;
+CallocFn real_calloc                = nullptr;
+ReallocFn real_realloc              = nullptr;
+FreeFn real_free                    = nullptr;
+AlignedAllocFn real_aligned_alloc   = nullptr;
+PosixMemalignFn real_posix_memalign = nullptr;
+bool resolving                      = false;
+
+// dlsym allocates before the real functions are known, those come from this buffer
+alignas(std::max_align_t) char bootstrap_buffer[8192];
+size_t bootstrap_used = 0;
+
+bool inBootstrap(const void* ptr) {
+  return ptr >= bootstrap_buffer && ptr < bootstrap_buffer + sizeof(bootstrap_buffer);
+}
+
+void* bootstrapAllocate(const size_t size) {
+  const size_t aligned = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+  if (bootstrap_used + aligned > sizeof(bootstrap_buffer)) {
+    return nullptr;
+  }
+  void* ptr = bootstrap_buffer + bootstrap_used;
+  bootstrap_used += aligned;
+  return ptr;
+}
+
+void resolve() {
+  if (real_free || resolving) {
+    return;
+  }
+  resolving           = true;
+  real_malloc         = reinterpret_cast<MallocFn>(dlsym(RTLD_NEXT, "malloc"));
+  real_calloc         = reinterpret_cast<CallocFn>(dlsym(RTLD_NEXT, "calloc"));
+  real_realloc        = reinterpret_cast<ReallocFn>(dlsym(RTLD_NEXT, "realloc"));
+  real_aligned_alloc  = reinterpret_cast<AlignedAllocFn>(dlsym(RTLD_NEXT, "aligned_alloc"));
+  real_posix_memalign = reinterpret_cast<PosixMemalignFn>(dlsym(RTLD_NEXT, "posix_memalign"));
+  real_free           = reinterpret_cast<FreeFn>(dlsym(RTLD_NEXT, "free"));
+  resolving           = false;
+}
+
+void countAllocation() {
+  if (count_allocations) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+  }
+}
+
+}  // namespace
+
+extern "C" {
+
+void* malloc(size_t size) {
+  resolve();
+  if (!real_malloc) {
+    return bootstrapAllocate(size);
+  }
+  countAllocation();
+  return real_malloc(size);
+}
+
+void* calloc(size_t count, size_t size) {
+  resolve();
+  if (!real_calloc) {
+    // static storage is already zeroed
+    return bootstrapAllocate(count * size);
+  }
+  countAllocation();
+  return real_calloc(count, size);
+}
+
+void* realloc(void* ptr, size_t size) {
+  resolve();
+  countAllocation();
+  if (inBootstrap(ptr)) {
+    void* moved = real_malloc(size);
+    const size_t available =
+        static_cast<size_t>(bootstrap_buffer + sizeof(bootstrap_buffer) - static_cast<char*>(ptr));
+    std::memcpy(moved, ptr, std::min(size, available));
+    return moved;
+  }
+  return real_realloc(ptr, size);
+}
+
+void* aligned_alloc(size_t alignment, size_t size) {
+  resolve();
+  countAllocation();
+  return real_aligned_alloc(alignment, size);
+}
+
+int posix_memalign(void** ptr, size_t alignment, size_t size) {
+  resolve();
+  countAllocation();
+  return real_posix_memalign(ptr, alignment, size);
+}
+
+void free(void* ptr) {
+  if (!ptr || inBootstrap(ptr)) {
+    return;
+  }
+  resolve();
+  real_free(ptr);
+}
+
+}  // extern "C"
+
+using namespace controller_plugin_base_test;
+
+// Negotiates SPEED_MODE and feeds the controller until it computes commands
+static void startController(std::shared_ptr<as2::Node> node,
+                            std::shared_ptr<MockPlatform> platform,
+                            MockController& controller) {
+  controller.initialize(node.get());
+  controller.setInputControlModesAvailables({SPEED_MODE});
+  controller.setOutputControlModesAvailables({ATTITUDE_MODE});
+
+  rclcpp::executors::SingleThreadedExecutor executor;
+  executor.add_node(node);
+  executor.add_node(platform);
+
+  // let the controller discover the platform services
+  spinFor(executor, std::chrono::milliseconds(500));
+  ASSERT_TRUE(requestControlMode(executor, platform, SPEED_MODE));
+  for (int i = 0; i < 5; i++) {
+    platform->publishPlatformInfo();
+    platform->publishState();
+    spinFor(executor, std::chrono::milliseconds(20));
+  }
+  executor.remove_node(node);
+  executor.remove_node(platform);
+
+  // warm up: first command publish and input buffers swap
+  for (int i = 0; i < 100; i++) {
+    controller.tick();
+  }
+}
+
+TEST(ControllerBaseAllocation, ControlTickDoesNotAllocate) {
+  auto node     = std::make_shared<as2::Node>("controller_allocation_test");
+  auto platform = std::make_shared<MockPlatform>(std::vector<uint8_t>{ATTITUDE_MODE});
+  MockController controller;
+  startController(node, platform, controller);
+  ASSERT_GT(controller.state_count, 0u);
+
+  const size_t compute_count = controller.compute_count;
+  allocation_count           = 0;
+  count_allocations          = true;
+  for (int i = 0; i < 1000; i++) {
+    controller.tick();
+  }
+  count_allocations = false;
+
+  EXPECT_EQ(controller.compute_count - compute_count, 1000u);
+  EXPECT_EQ(allocation_count.load(), 0u);
+}
+
+TEST(ControllerBaseAllocation, ParameterUpdateReachesTheTickWithoutAllocating) {
+  auto node     = std::make_shared<as2::Node>("controller_parameter_test");
+  auto platform = std::make_shared<MockPlatform>(std::vector<uint8_t>{ATTITUDE_MODE});
+  MockController controller;
+  startController(node, platform, controller);
+  ASSERT_GT(controller.state_count, 0u);
+
+  EXPECT_FALSE(node->set_parameter(rclcpp::Parameter("mock.gain", -1.0)).successful);
+  EXPECT_TRUE(node->set_parameter(rclcpp::Parameter("mock.gain", 2.0)).successful);
+
+  allocation_count  = 0;
+  count_allocations = true;
+  for (int i = 0; i < 1000; i++) {
+    controller.tick();
+  }
+  count_allocations = false;
+
+  EXPECT_DOUBLE_EQ(controller.gain.get(), 2.0);
+  EXPECT_EQ(allocation_count.load(), 0u);
+}
+
+TEST(ControllerBaseAllocation, ExecutorTicksDoNotAllocate) {
+  // fast enough to run the ticks in a second, the state is not refreshed meanwhile. Commands
+  // are handed over from the message pools
+  rclcpp::NodeOptions options;
+  options.use_intra_process_comms(true);
+  options.automatically_declare_parameters_from_overrides(true);
+  options.parameter_overrides({{"publish_cmd_freq", 1000.0}, {"watchdog.state_timeout", 0.0}});
+  auto node     = std::make_shared<as2::Node>("controller_executor_allocation_test", options);
+  auto platform = std::make_shared<MockPlatform>(std::vector<uint8_t>{ATTITUDE_MODE});
+  MockController controller;
+  startController(node, platform, controller);
+  ASSERT_GT(controller.state_count, 0u);
+
+  // the control loop on its own executor thread, as the realtime host runs it
+  rclcpp::executors::SingleThreadedExecutor executor;
+  executor.add_callback_group(controller.getControlCallbackGroup(),
+                              node->get_node_base_interface());
+  allocation_count = 0;
+  size_t ticks     = 0;
+  std::thread control_thread([&]() {
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    // warm up the executor as well, its wait set is sized on the first spins
+    for (int i = 0; i < 100; i++) {
+      executor.spin_once(std::chrono::milliseconds(10));
+    }
+    const size_t compute_count = controller.compute_count;
+    count_allocations          = true;
+    while (controller.compute_count - compute_count < 1000 &&
+           std::chrono::steady_clock::now() < timeout) {
+      executor.spin_once(std::chrono::milliseconds(10));
+    }
+    count_allocations = false;
+    ticks             = controller.compute_count - compute_count;
+  });
+  control_thread.join();
+
+  EXPECT_EQ(ticks, 1000u);
+  EXPECT_EQ(allocation_count.load(), 0u);
+}
+
+TEST(ControllerBaseAllocation, OdometryInputDoesNotAllocate) {
+  rclcpp::NodeOptions options;
+  options.automatically_declare_parameters_from_overrides(true);
+  options.parameter_overrides({{"state_source", "odometry"}, {"watchdog.state_timeout", 0.0}});
+  auto node     = std::make_shared<as2::Node>("controller_odometry_allocation_test", options);
+  auto platform = std::make_shared<MockPlatform>(std::vector<uint8_t>{ATTITUDE_MODE});
+  MockController controller;
+  startController(node, platform, controller);
+  ASSERT_GT(controller.state_count, 0u);
+
+  // the odometry callbacks on their own executor thread, only that thread is counted
+  rclcpp::executors::SingleThreadedExecutor executor;
+  executor.add_callback_group(controller.getInputCallbackGroup(), node->get_node_base_interface());
+  allocation_count = 0;
+  std::atomic<bool> warm{false}, stop{false};
+  std::thread input_thread([&]() {
+    for (int i = 0; i < 100; i++) {
+      executor.spin_once(std::chrono::milliseconds(1));
+    }
+    warm              = true;
+    count_allocations = true;
+    while (!stop) {
+      executor.spin_once(std::chrono::milliseconds(1));
+    }
+    count_allocations = false;
+  });
+  while (!warm) {
+    platform->publishOdometry();
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  // more messages than the ring holds, so the split messages are reused
+  for (int i = 0; i < 200; i++) {
+    platform->publishOdometry(static_cast<double>(i));
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+  }
+  platform->publishOdometry(-1.0);
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  stop = true;
+  input_thread.join();
+
+  // the last sample reaches the plugin
+  controller.tick();
+  EXPECT_DOUBLE_EQ(controller.last_z, -1.0);
+  EXPECT_EQ(allocation_count.load(), 0u);
+}
+
+int main(int argc, char** argv) {
+  rclcpp::init(argc, argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  const int result = RUN_ALL_TESTS();
+  rclcpp::shutdown();
+  return result;
+}
@@ -0,0 +1,104 @@
+/********************************************************************************************
+ *  \file       control_loop_test.cpp
+ *  \brief      Checks the control deadline tracking against early and late ticks
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#include <gtest/gtest.h>
+
+#include <rcl/time.h>
+
+#include "controller_test_utils.hpp"
+
+using namespace controller_plugin_base_test;
+
+// Ticks the control loop at simulated times, the control timer itself is never spun
+class ControlLoopTest : public ::testing::Test {
+  protected:
+  void SetUp() override {
+    node_ = std::make_shared<as2::Node>("controller_control_loop_test");
+    controller_.initialize(node_.get());
+    period_ = std::chrono::nanoseconds(
+        static_cast<int64_t>(1e9 / controller_.getControlFrequency()));
+    ASSERT_EQ(rcl_enable_ros_time_override(node_->get_clock()->get_clock_handle()), RCL_RET_OK);
+  };
+
+  // tick at start + periods * period
+  void tickAt(const double periods) {
+    const int64_t time_ns = start_ns_ + static_cast<int64_t>(periods * period_.count());
+    ASSERT_EQ(rcl_set_ros_time_override(node_->get_clock()->get_clock_handle(), time_ns),
+              RCL_RET_OK);
+    controller_.tick();
+  };
+
+  std::shared_ptr<as2::Node> node_;
+  MockController controller_;
+  std::chrono::nanoseconds period_;
+  const int64_t start_ns_ = 1000000000000;
+};
+
+TEST_F(ControlLoopTest, EarlyTicksAdvanceTheDeadline) {
+  const double early = 0.1;
+  tickAt(0.0);
+  tickAt(1.0 - early);
+  // on time for the third deadline, it only looks late if the early tick did not advance it
+  tickAt(2.5);
+  tickAt(3.0 - early);
+  tickAt(4.0 - early);
+  tickAt(5.5);
+  EXPECT_EQ(controller_.getControlMissedTickCount(), 0u);
+}
+
+TEST_F(ControlLoopTest, LateTicksCountTheSkippedPeriods) {
+  tickAt(0.0);
+  // less than one period late, the ticks in between were not lost
+  tickAt(1.5);
+  EXPECT_EQ(controller_.getControlMissedTickCount(), 0u);
+  tickAt(3.0);
+  EXPECT_EQ(controller_.getControlMissedTickCount(), 0u);
+  // two and a half periods late, the deadlines at 4 and 5 were skipped
+  tickAt(5.5);
+  EXPECT_EQ(controller_.getControlMissedTickCount(), 2u);
+  // back on the grid
+  tickAt(6.0);
+  tickAt(7.0);
+  EXPECT_EQ(controller_.getControlMissedTickCount(), 2u);
+}
+
+int main(int argc, char** argv) {
+  rclcpp::init(argc, argv);
+  ::testing::InitGoogleTest(&argc, argv);
+  const int result = RUN_ALL_TESTS();
+  rclcpp::shutdown();
+  return result;
+}
@@ -0,0 +1,176 @@
+/********************************************************************************************
+ *  \file       controller_base_benchmark.cpp
+ *  \brief      Benchmarks of the ControllerBase control loop pipeline
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "controller_test_utils.hpp"
+
+using namespace controller_plugin_base_test;
+
+// Controller plugin, its node and a mock platform, with a negotiated mode and a received state
+struct ControllerFixture {
+  ControllerFixture(const std::string& ns = "", double cmd_freq = 100.0) {
+    rclcpp::NodeOptions options;
+    options.parameter_overrides({{"publish_cmd_freq", cmd_freq}, {"publish_info_freq", 0.0}});
+    if (!ns.empty()) {
+      options.arguments({"--ros-args", "-r", "__ns:=/" + ns});
+    }
+    node     = std::make_shared<as2::Node>("controller_benchmark", options);
+    platform = std::make_shared<MockPlatform>(std::vector<uint8_t>{ATTITUDE_MODE}, "mock_platform",
+                                              ns);
+    controller.initialize(node.get());
+    controller.setInputControlModesAvailables({SPEED_MODE});
+    controller.setOutputControlModesAvailables({ATTITUDE_MODE});
+
+    executor.add_node(node);
+    executor.add_node(platform);
+    spinFor(executor, std::chrono::milliseconds(500));
+    ready = requestControlMode(executor, platform, SPEED_MODE);
+    platform->publishPlatformInfo();
+    platform->publishState();
+    spinFor(executor, std::chrono::milliseconds(50));
+  }
+
+  ~ControllerFixture() {
+    executor.remove_node(node);
+    executor.remove_node(platform);
+  }
+
+  std::shared_ptr<as2::Node> node;
+  std::shared_ptr<MockPlatform> platform;
+  MockController controller;
+  rclcpp::executors::SingleThreadedExecutor executor;
+  bool ready = false;
+};
+
+// Cost of one control_timer_callback -> sendCommand iteration
+static void BM_ControlTick(benchmark::State& state) {
+  ControllerFixture fixture;
+  if (!fixture.ready) {
+    state.SkipWithError("Control mode negotiation failed");
+    return;
+  }
+  for (auto _ : state) {
+    fixture.controller.tick();
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_ControlTick);
+
+// Tick cost with N controller instances in the same process, ticked round robin
+static void BM_ControlTickScaling(benchmark::State& state) {
+  const size_t n_controllers = state.range(0);
+  std::vector<std::unique_ptr<ControllerFixture>> fixtures;
+  for (size_t i = 0; i < n_controllers; i++) {
+    fixtures.emplace_back(std::make_unique<ControllerFixture>("drone" + std::to_string(i)));
+    if (!fixtures.back()->ready) {
+      state.SkipWithError("Control mode negotiation failed");
+      return;
+    }
+  }
+  for (auto _ : state) {
+    for (auto& fixture : fixtures) {
+      fixture->controller.tick();
+    }
+  }
+  state.SetItemsProcessed(state.iterations() * n_controllers);
+}
+BENCHMARK(BM_ControlTickScaling)->RangeMultiplier(2)->Range(1, 32)->Unit(benchmark::kMicrosecond);
+
+// Time from a state published by the platform to the command computed from it
+static void BM_StateToCommandLatency(benchmark::State& state) {
+  ControllerFixture fixture("", static_cast<double>(state.range(0)));
+  if (!fixture.ready) {
+    state.SkipWithError("Control mode negotiation failed");
+    return;
+  }
+
+  std::atomic<double> last_thrust{-1.0};
+  auto command_sub = fixture.platform->create_subscription<as2_msgs::msg::Thrust>(
+      as2_names::topics::actuator_command::thrust, as2_names::topics::actuator_command::qos,
+      [&last_thrust](const as2_msgs::msg::Thrust::SharedPtr msg) { last_thrust = msg->thrust; });
+  spinFor(fixture.executor, std::chrono::milliseconds(200));
+
+  double sequence = 1.0;
+  for (auto _ : state) {
+    sequence += 1.0;
+    fixture.platform->publishState(sequence);
+    const auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    while (last_thrust != sequence && std::chrono::steady_clock::now() < timeout) {
+      fixture.executor.spin_once(std::chrono::milliseconds(1));
+    }
+    if (last_thrust != sequence) {
+      state.SkipWithError("No command received for the published state");
+      break;
+    }
+  }
+}
+BENCHMARK(BM_StateToCommandLatency)
+    ->Arg(100)
+    ->Arg(250)
+    ->Arg(500)
+    ->Arg(1000)
+    ->Unit(benchmark::kMicrosecond)
+    ->UseRealTime();
+
+// Round trip of a set_control_mode request negotiated against the mock platform
+static void BM_ModeNegotiation(benchmark::State& state) {
+  ControllerFixture fixture;
+  if (!fixture.ready) {
+    state.SkipWithError("Control mode negotiation failed");
+    return;
+  }
+  for (auto _ : state) {
+    if (!requestControlMode(fixture.executor, fixture.platform, SPEED_MODE)) {
+      state.SkipWithError("Control mode negotiation failed");
+      break;
+    }
+  }
+}
+BENCHMARK(BM_ModeNegotiation)->Unit(benchmark::kMicrosecond)->UseRealTime();
+
+int main(int argc, char** argv) {
+  rclcpp::init(argc, argv);
+  benchmark::Initialize(&argc, argv);
+  benchmark::RunSpecifiedBenchmarks();
+  rclcpp::shutdown();
+  return 0;
+}
@@ -0,0 +1,224 @@
+/********************************************************************************************
+ *  \file       controller_test_utils.hpp
+ *  \brief      Mock controller plugin and mock platform used by the controller_plugin_base tests
+ *  \authors    Miguel Fernández Cortizas
+ *              Pedro Arias Pérez
+ *              David Pérez Saura
+ *              Rafael Pérez Seguí
+ *
+ *  \copyright  Copyright (c) 2022 Universidad Politécnica de Madrid
+ *              All Rights Reserved
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *
+ * 1. Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ * 3. Neither the name of the copyright holder nor the names of its contributors
+ *    may be used to endorse or promote products derived from this software
+ *    without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS
+ * "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO,
+ * THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+ * PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR
+ * CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL,
+ * EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS;
+ * OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY,
+ * WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE,
+ * EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ ********************************************************************************/
+
+#ifndef CONTROLLER_TEST_UTILS_HPP
+#define CONTROLLER_TEST_UTILS_HPP
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <rclcpp/rclcpp.hpp>
+
+#include "as2_core/control_mode_utils/control_mode_utils.hpp"
+#include "as2_core/names/services.hpp"
+#include "as2_core/names/topics.hpp"
+#include "as2_core/node.hpp"
+#include "as2_msgs/msg/platform_info.hpp"
+#include "as2_msgs/srv/list_control_modes.hpp"
+#include "as2_msgs/srv/set_control_mode.hpp"
+#include "controller_plugin_base/controller_base.hpp"
+#include "nav_msgs/msg/odometry.hpp"
+
+namespace controller_plugin_base_test {
+
+// SPEED with yaw SPEED in the GLOBAL_ENU_FRAME
+constexpr uint8_t SPEED_MODE = 0b01000101;
+// ATTITUDE with yaw SPEED
+constexpr uint8_t ATTITUDE_MODE = 0b00110101;
+
+class MockController : public controller_plugin_base::ControllerBase {
+  public:
+  void ownInitialize() override { node_ptr_->declare_parameter<double>("mock.gain", 1.0); };
+
+  bool updateParameters(const std::vector<rclcpp::Parameter>& parameters,
+                        std::string& reason) override {
+    for (const auto& parameter : parameters) {
+      if (parameter.get_name() != "mock.gain") {
+        continue;
+      }
+      if (parameter.as_double() <= 0.0) {
+        reason = "mock.gain must be positive";
+        return false;
+      }
+      gain.publish(parameter.as_double());
+    }
+    return true;
+  };
+
+  void updateState(const geometry_msgs::msg::PoseStamped& pose_msg,
+                   const geometry_msgs::msg::TwistStamped& twist_msg) override {
+    state_count++;
+    last_z = pose_msg.pose.position.z;
+  };
+
+  void updateReference(const geometry_msgs::msg::TwistStamped& ref) override {
+    ref_vz = ref.twist.linear.z;
+  };
+
+  void computeOutput(geometry_msgs::msg::PoseStamped& pose,
+                     geometry_msgs::msg::TwistStamped& twist,
+                     as2_msgs::msg::Thrust& thrust) override {
+    compute_count++;
+    gain.update();
+    pose.header.frame_id = "earth";
+    pose.pose.orientation.w = 1.0;
+    twist.twist.angular.z = 0.1;
+    // the thrust echoes the last state, so commands can be matched with the state that
+    // produced them
+    thrust.thrust = (last_z + ref_vz) * gain.get();
+  };
+
+  bool setMode(const as2_msgs::msg::ControlMode& mode_in,
+               const as2_msgs::msg::ControlMode& mode_out) override {
+    return true;
+  };
+
+  // run one control loop iteration outside of the executor
+  void tick() { control_timer_callback(); };
+
+  size_t state_count   = 0;
+  size_t compute_count = 0;
+  double last_z        = 0.0;
+  double ref_vz        = 0.0;
+  controller_plugin_base::ParameterSnapshot<double> gain{1.0};
+};
+
+// Platform side: control mode services, platform info and state publishers
+class MockPlatform : public rclcpp::Node {
+  public:
+  explicit MockPlatform(const std::vector<uint8_t>& available_modes,
+                        const std::string& name = "mock_platform",
+                        const std::string& ns   = "")
+      : rclcpp::Node(name, ns), available_modes_(available_modes) {
+    list_srv_ = create_service<as2_msgs::srv::ListControlModes>(
+        as2_names::services::platform::list_control_modes,
+        [this](const as2_msgs::srv::ListControlModes::Request::SharedPtr,
+               as2_msgs::srv::ListControlModes::Response::SharedPtr response) {
+          response->control_modes = available_modes_;
+        });
+    set_srv_ = create_service<as2_msgs::srv::SetControlMode>(
+        as2_names::services::platform::set_platform_control_mode,
+        [this](const as2_msgs::srv::SetControlMode::Request::SharedPtr request,
+               as2_msgs::srv::SetControlMode::Response::SharedPtr response) {
+          set_mode_count++;
+          response->success = true;
+        });
+    info_pub_ = create_publisher<as2_msgs::msg::PlatformInfo>(as2_names::topics::platform::info,
+                                                              as2_names::topics::platform::qos);
+    pose_pub_ = create_publisher<geometry_msgs::msg::PoseStamped>(
+        as2_names::topics::self_localization::pose, as2_names::topics::self_localization::qos);
+    twist_pub_ = create_publisher<geometry_msgs::msg::TwistStamped>(
+        as2_names::topics::self_localization::twist, as2_names::topics::self_localization::qos);
+    odometry_pub_ = create_publisher<nav_msgs::msg::Odometry>(
+        "self_localization/odom", as2_names::topics::self_localization::qos);
+  };
+
+  void publishPlatformInfo(bool armed = true, bool offboard = true) {
+    as2_msgs::msg::PlatformInfo msg;
+    msg.header.stamp = now();
+    msg.connected    = true;
+    msg.armed        = armed;
+    msg.offboard     = offboard;
+    info_pub_->publish(msg);
+  };
+
+  void publishState(double z = 1.0) {
+    geometry_msgs::msg::PoseStamped pose;
+    geometry_msgs::msg::TwistStamped twist;
+    pose.header.stamp           = now();
+    pose.header.frame_id        = "earth";
+    pose.pose.position.z        = z;
+    pose.pose.orientation.w     = 1.0;
+    twist.header                = pose.header;
+    pose_pub_->publish(pose);
+    twist_pub_->publish(twist);
+    publishOdometry(z);
+  };
+
+  // the same state for controllers with state_source odometry
+  void publishOdometry(double z = 1.0) {
+    nav_msgs::msg::Odometry odometry;
+    odometry.header.stamp            = now();
+    odometry.header.frame_id         = "earth";
+    odometry.pose.pose.position.z    = z;
+    odometry.pose.pose.orientation.w = 1.0;
+    odometry_pub_->publish(odometry);
+  };
+
+  size_t set_mode_count = 0;
+
+  private:
+  std::vector<uint8_t> available_modes_;
+  rclcpp::Service<as2_msgs::srv::ListControlModes>::SharedPtr list_srv_;
+  rclcpp::Service<as2_msgs::srv::SetControlMode>::SharedPtr set_srv_;
+  rclcpp::Publisher<as2_msgs::msg::PlatformInfo>::SharedPtr info_pub_;
+  rclcpp::Publisher<geometry_msgs::msg::PoseStamped>::SharedPtr pose_pub_;
+  rclcpp::Publisher<geometry_msgs::msg::TwistStamped>::SharedPtr twist_pub_;
+  rclcpp::Publisher<nav_msgs::msg::Odometry>::SharedPtr odometry_pub_;
+};
+
+// Call the controller set_control_mode service and spin until it answers
+inline bool requestControlMode(rclcpp::Executor& executor,
+                               rclcpp::Node::SharedPtr client_node,
+                               const uint8_t mode,
+                               std::chrono::nanoseconds timeout = std::chrono::seconds(5)) {
+  auto client = client_node->create_client<as2_msgs::srv::SetControlMode>(
+      as2_names::services::controller::set_control_mode);
+  if (!client->wait_for_service(timeout)) {
+    return false;
+  }
+  auto request          = std::make_shared<as2_msgs::srv::SetControlMode::Request>();
+  request->control_mode = as2::convertUint8tToAS2ControlMode(mode);
+  auto future           = client->async_send_request(request);
+  if (executor.spin_until_future_complete(future, timeout) != rclcpp::FutureReturnCode::SUCCESS) {
+    return false;
+  }
+  return future.get()->success;
+}
+
+// Spin the executor for a while so published messages are delivered
+inline void spinFor(rclcpp::Executor& executor, std::chrono::nanoseconds duration) {
+  const auto end = std::chrono::steady_clock::now() + duration;
+  while (std::chrono::steady_clock::now() < end) {
+    executor.spin_some(std::chrono::milliseconds(10));
+  }
+}
+
+}  // namespace controller_plugin_base_test
+
+#endif  // CONTROLLER_TEST_UTILS_HPP